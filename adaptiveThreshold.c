@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+#include "adaptiveThreshold.h"
+
+#define ROW(m, y) ((m)->data.ptr + (y)*(m)->step)
+
+void adaptiveThresholdScratchInit(adaptiveThresholdScratch_t* scratch, int width)
+{
+    scratch->width   = width;
+    scratch->colSums = malloc(width * sizeof(uint16_t));
+    scratch->rowSums = malloc((width + MAX_ADAPTIVE_THRESHOLD_BLOCK) * sizeof(uint32_t));
+    scratch->history = malloc((MAX_ADAPTIVE_THRESHOLD_BLOCK/2 + 1) * width);
+}
+
+void adaptiveThresholdScratchRelease(adaptiveThresholdScratch_t* scratch)
+{
+    free(scratch->colSums);
+    free(scratch->rowSums);
+    free(scratch->history);
+    scratch->colSums = NULL;
+    scratch->rowSums = NULL;
+    scratch->history = NULL;
+}
+
+void adaptiveThresholdMeanInv(const CvMat* src, CvMat* dst, adaptiveThresholdScratch_t* scratch,
+                              int blockSize, int delta, uint8_t maxValue)
+{
+    if(blockSize > MAX_ADAPTIVE_THRESHOLD_BLOCK)
+    {
+        cvAdaptiveThreshold(src, dst, maxValue, CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY_INV,
+                            blockSize, delta);
+        return;
+    }
+
+    int w = src->cols, h = src->rows;
+    int r = blockSize/2;
+
+    // A pixel is set if round(sum/area) >= pixel + delta. The sum is an integer and the area is odd,
+    // so the mean is never exactly halfway between two integers, and this is the same as
+    // 2*sum >= (2*(pixel + delta) - 1)*area, which needs no division
+    const int32_t area   = blockSize*blockSize;
+    const int32_t scale  = 2*area;
+    const int32_t offset = (2*delta - 1)*area;
+
+    // colSums[x] is the sum of column x over the rows of the current block. rowSums[] holds the
+    // prefix sums of colSums[] with r replicated columns on either side, so that the sum of each
+    // block is a single difference. I keep a copy of the last r+1 rows, because the row leaving the
+    // block may already have been overwritten with the mask, if src == dst
+    uint16_t* colSums = scratch->colSums;
+    uint32_t* rowSums = scratch->rowSums;
+    uint8_t*  history = scratch->history;
+
+    const uint8_t* first = ROW(src, 0);
+    for(int x=0; x<w; x++)
+        colSums[x] = (r+1)*first[x];
+    for(int y=1; y<=r; y++)
+    {
+        const uint8_t* in = ROW(src, MIN(y, h-1));
+        for(int x=0; x<w; x++)
+            colSums[x] += in[x];
+    }
+
+    for(int y=0; y<h; y++)
+    {
+        if(y > 0)
+        {
+            // the 16-bit arithmetic may wrap in the middle, but the result is in range
+            const uint8_t* in  = ROW(src, MIN(y+r, h-1));
+            const uint8_t* out = &history[(MAX(y-1-r, 0) % (r+1))*w];
+            for(int x=0; x<w; x++)
+                colSums[x] += in[x] - out[x];
+        }
+
+        uint8_t* row = &history[(y % (r+1))*w];
+        memcpy(row, ROW(src, y), w);
+
+        uint32_t sum = 0;
+        int i = 0;
+        rowSums[i++] = 0;
+        for(int x=0; x<r; x++)   rowSums[i++] = (sum += colSums[0]);
+        for(int x=0; x<w; x++)   rowSums[i++] = (sum += colSums[x]);
+        for(int x=0; x<r; x++)   rowSums[i++] = (sum += colSums[w-1]);
+
+        uint8_t* mask = ROW(dst, y);
+        for(int x=0; x<w; x++)
+        {
+            int32_t blockSum = rowSums[x + blockSize] - rowSums[x];
+            mask[x] = 2*blockSum >= row[x]*scale + offset ? maxValue : 0;
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef __ADAPTIVE_THRESHOLD_H__
+#define __ADAPTIVE_THRESHOLD_H__
+
+#include <stdint.h>
+#include "cvlib.hh"
+
+// An inverted mean-C adaptive threshold of a CV_8UC1 image, bit-for-bit the same as
+//
+//   cvAdaptiveThreshold(src, dst, maxValue, CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY_INV,
+//                       blockSize, delta)
+//
+// A pixel is set to maxValue if it's at least delta below the rounded mean of the blockSize x
+// blockSize block around it (with the borders replicated), and to 0 otherwise. cvAdaptiveThreshold()
+// box-filters the whole image into a temporary, then compares. Here the block sums come from running
+// column sums, and each row of the mask is emitted as soon as its sums are ready, so the cost doesn't
+// depend on blockSize, and the mean image is never stored. src and dst may be the same, and may be
+// views into larger images. blockSize must be odd. Blocks larger than MAX_ADAPTIVE_THRESHOLD_BLOCK,
+// whose column sums wouldn't fit in 16 bits, fall back to cvAdaptiveThreshold()
+#define MAX_ADAPTIVE_THRESHOLD_BLOCK 257
+
+// The row buffers of adaptiveThresholdMeanInv(), allocated once for images up to width wide and
+// blocks up to MAX_ADAPTIVE_THRESHOLD_BLOCK
+typedef struct
+{
+    int       width;
+    uint16_t* colSums;
+    uint32_t* rowSums;
+    uint8_t*  history;
+} adaptiveThresholdScratch_t;
+
+void adaptiveThresholdScratchInit   (adaptiveThresholdScratch_t* scratch, int width);
+void adaptiveThresholdScratchRelease(adaptiveThresholdScratch_t* scratch);
+
+// scratch must be at least as wide as src
+void adaptiveThresholdMeanInv(const CvMat* src, CvMat* dst, adaptiveThresholdScratch_t* scratch,
+                              int blockSize, int delta, uint8_t maxValue);
+
+#endif
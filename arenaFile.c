@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "arenaFile.h"
+
+bool readArenaFile(const char* filename, arena_t* arenas, int* numArenas)
+{
+    FILE* fp = fopen(filename, "r");
+    if(fp == NULL)
+    {
+        fprintf(stderr, "couldn't open arena file '%s'\n", filename);
+        return false;
+    }
+
+    *numArenas = 0;
+    char line[1024];
+    int  lineNumber = 0;
+    bool ok = true;
+    while(ok && fgets(line, sizeof(line), fp) != NULL)
+    {
+        lineNumber++;
+
+        char* token = strtok(line, " \t\r\n");
+        if(token == NULL || token[0] == '#')
+            continue;
+
+        if(*numArenas >= MAX_ARENAS)
+        {
+            fprintf(stderr, "%s:%d: too many arenas. At most %d are supported\n",
+                    filename, lineNumber, MAX_ARENAS);
+            ok = false;
+            break;
+        }
+
+        arena_t* arena = &arenas[*numArenas];
+        arena->numVertices = 0;
+        if(strcmp(token, "circle") == 0)
+        {
+            char* args = strtok(NULL, "\r\n");
+            if(args == NULL ||
+               sscanf(args, "%d %d %d", &arena->center.x, &arena->center.y, &arena->radius) != 3 ||
+               arena->radius <= 0)
+            {
+                fprintf(stderr, "%s:%d: expected 'circle X Y RADIUS'\n", filename, lineNumber);
+                ok = false;
+            }
+        }
+        else if(strcmp(token, "polygon") == 0)
+        {
+            int sumX = 0, sumY = 0;
+            while((token = strtok(NULL, " \t\r\n")) != NULL)
+            {
+                CvPoint* vertex = &arena->vertices[arena->numVertices];
+                if(arena->numVertices >= MAX_ARENA_VERTICES ||
+                   sscanf(token, "%d,%d", &vertex->x, &vertex->y) != 2)
+                {
+                    ok = false;
+                    break;
+                }
+                sumX += vertex->x;
+                sumY += vertex->y;
+                arena->numVertices++;
+            }
+
+            if(!ok || arena->numVertices < 3)
+            {
+                fprintf(stderr, "%s:%d: expected 'polygon X0,Y0 X1,Y1 X2,Y2 ...' with 3 to %d vertices\n",
+                        filename, lineNumber, MAX_ARENA_VERTICES);
+                ok = false;
+            }
+            else
+            {
+                arena->center = cvPoint(sumX / arena->numVertices, sumY / arena->numVertices);
+                arena->radius = 0;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "%s:%d: unknown arena type '%s'\n", filename, lineNumber, token);
+            ok = false;
+        }
+
+        if(ok)
+            (*numArenas)++;
+    }
+    fclose(fp);
+
+    if(ok && *numArenas == 0)
+    {
+        fprintf(stderr, "arena file '%s' has no arenas\n", filename);
+        ok = false;
+    }
+    return ok;
+}
+
+// A downsampled pixel covers downsample x downsample full-resolution pixels, so their centers map
+// to each other with a half-pixel shift
+static CvPoint scalePoint(CvPoint p, int downsample)
+{
+    return cvPoint((int)lrint((p.x + 0.5) / downsample - 0.5),
+                   (int)lrint((p.y + 0.5) / downsample - 0.5));
+}
+
+void arenaMapAddArenas(arenaMap_t* map, const arena_t* arenas, int numArenas, int downsample)
+{
+    for(int i=0; i<numArenas; i++)
+    {
+        const arena_t* arena = &arenas[i];
+        if(arena->numVertices == 0)
+        {
+            int radius = (int)lrint((double)arena->radius / downsample);
+            arenaMapAddCircle(map, scalePoint(arena->center, downsample), radius);
+        }
+        else
+        {
+            CvPoint vertices[MAX_ARENA_VERTICES];
+            for(int j=0; j<arena->numVertices; j++)
+                vertices[j] = scalePoint(arena->vertices[j], downsample);
+            arenaMapAddPolygon(map, vertices, arena->numVertices);
+        }
+    }
+}
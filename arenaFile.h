@@ -0,0 +1,31 @@
+#ifndef __ARENA_FILE_H__
+#define __ARENA_FILE_H__
+
+#include <stdbool.h>
+#include "cvlib.hh"
+#include "wormProcessing.h"
+
+#define MAX_ARENA_VERTICES 32
+
+// An arena, in full-resolution frame coordinates. A circle has numVertices == 0; a polygon's center
+// is the mean of its vertices, and its radius is 0
+typedef struct
+{
+    CvPoint center;
+    int     radius;
+    int     numVertices;
+    CvPoint vertices[MAX_ARENA_VERTICES];
+} arena_t;
+
+// Reads fixed arenas from a file. Each line is either
+//   circle X Y RADIUS
+//   polygon X0,Y0 X1,Y1 X2,Y2 ...
+// Blank lines and lines starting with # are ignored. At most MAX_ARENAS are read. The errors are
+// reported to stderr
+bool readArenaFile(const char* filename, arena_t* arenas, int* numArenas);
+
+// Adds the arenas to the map, in order. The map covers a frame downsampled by the given factor
+// (1 for full resolution), so the geometry is scaled down to match
+void arenaMapAddArenas(arenaMap_t* map, const arena_t* arenas, int numArenas, int downsample);
+
+#endif
@@ -0,0 +1,198 @@
+#include "asyncFrameWriter.hh"
+
+AsyncFrameWriter::AsyncFrameWriter()
+    : slots(NULL), pooled(NULL), timestamps(NULL), capacity(0), head(0), count(0),
+      running(false), quitting(false), numDropped(0), callback(NULL)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&haveFrames, NULL);
+    pthread_cond_init(&drained, NULL);
+}
+
+AsyncFrameWriter::~AsyncFrameWriter()
+{
+    stop();
+
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&haveFrames);
+    pthread_cond_destroy(&drained);
+}
+
+bool AsyncFrameWriter::start(int w, int h, int queueLength, AsyncFrameWriterCallback_t* _callback)
+{
+    stop();
+
+    // the writer thread isn't running, but the getters may be called from other threads
+    pthread_mutex_lock(&mutex);
+    capacity   = queueLength;
+    callback   = _callback;
+    head       = count = 0;
+    numDropped = 0;
+    quitting   = false;
+    pthread_mutex_unlock(&mutex);
+
+    slots      = new IplImage*   [capacity];
+    pooled     = new PooledFrame*[capacity];
+    timestamps = new uint64_t    [capacity];
+    for(int i=0; i<capacity; i++)
+    {
+        slots[i]  = cvCreateImage(cvSize(w, h), IPL_DEPTH_8U, 1);
+        pooled[i] = NULL;
+    }
+
+    if(pthread_create(&thread, NULL, &threadEntry, this) != 0)
+    {
+        stop();
+        return false;
+    }
+
+    pthread_mutex_lock(&mutex);
+    running = true;
+    pthread_mutex_unlock(&mutex);
+    return true;
+}
+
+void AsyncFrameWriter::stop(void)
+{
+    if(running)
+    {
+        pthread_mutex_lock(&mutex);
+        while(count > 0)
+            pthread_cond_wait(&drained, &mutex);
+        quitting = true;
+        pthread_cond_signal(&haveFrames);
+        pthread_mutex_unlock(&mutex);
+
+        pthread_join(thread, NULL);
+
+        pthread_mutex_lock(&mutex);
+        running = false;
+        pthread_mutex_unlock(&mutex);
+    }
+
+    if(slots != NULL)
+    {
+        for(int i=0; i<capacity; i++)
+            cvReleaseImage(&slots[i]);
+        delete[] slots;
+        delete[] pooled;
+        delete[] timestamps;
+        slots      = NULL;
+        pooled     = NULL;
+        timestamps = NULL;
+    }
+}
+
+bool AsyncFrameWriter::push(const IplImage* frame, uint64_t timestamp_us)
+{
+    pthread_mutex_lock(&mutex);
+    if(!running || count == capacity)
+    {
+        numDropped++;
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    int slot = (head + count) % capacity;
+    pthread_mutex_unlock(&mutex);
+
+    // The writer thread only touches the slots that are already queued, so I can fill this one
+    // without holding the lock
+    cvCopy(frame, slots[slot]);
+    timestamps[slot] = timestamp_us;
+
+    pthread_mutex_lock(&mutex);
+    count++;
+    pthread_cond_signal(&haveFrames);
+    pthread_mutex_unlock(&mutex);
+    return true;
+}
+
+bool AsyncFrameWriter::pushPooled(PooledFrame* frame)
+{
+    pthread_mutex_lock(&mutex);
+    if(!running || count == capacity)
+    {
+        numDropped++;
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    int slot = (head + count) % capacity;
+
+    frame->retain();
+    pooled    [slot] = frame;
+    timestamps[slot] = frame->timestamp_us;
+
+    count++;
+    pthread_cond_signal(&haveFrames);
+    pthread_mutex_unlock(&mutex);
+    return true;
+}
+
+void* AsyncFrameWriter::threadEntry(void* cookie)
+{
+    ((AsyncFrameWriter*)cookie)->threadLoop();
+    return NULL;
+}
+
+void AsyncFrameWriter::threadLoop(void)
+{
+    pthread_mutex_lock(&mutex);
+    while(1)
+    {
+        while(count == 0 && !quitting)
+            pthread_cond_wait(&haveFrames, &mutex);
+        if(count == 0)
+            break;
+
+        int slot = head;
+        pthread_mutex_unlock(&mutex);
+
+        if(pooled[slot] != NULL)
+        {
+            (*callback)(&pooled[slot]->image, timestamps[slot]);
+            pooled[slot]->release();
+            pooled[slot] = NULL;
+        }
+        else
+            (*callback)(slots[slot], timestamps[slot]);
+
+        pthread_mutex_lock(&mutex);
+        head = (head + 1) % capacity;
+        count--;
+        if(count == 0)
+            pthread_cond_broadcast(&drained);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+bool AsyncFrameWriter::isRunning(void)
+{
+    pthread_mutex_lock(&mutex);
+    bool result = running;
+    pthread_mutex_unlock(&mutex);
+    return result;
+}
+
+int AsyncFrameWriter::getQueueDepth(void)
+{
+    pthread_mutex_lock(&mutex);
+    int result = count;
+    pthread_mutex_unlock(&mutex);
+    return result;
+}
+
+int AsyncFrameWriter::getCapacity(void)
+{
+    pthread_mutex_lock(&mutex);
+    int result = capacity;
+    pthread_mutex_unlock(&mutex);
+    return result;
+}
+
+uint64_t AsyncFrameWriter::getNumDropped(void)
+{
+    pthread_mutex_lock(&mutex);
+    uint64_t result = numDropped;
+    pthread_mutex_unlock(&mutex);
+    return result;
+}
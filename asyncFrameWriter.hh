@@ -0,0 +1,59 @@
+#ifndef __ASYNC_FRAME_WRITER_HH__
+#define __ASYNC_FRAME_WRITER_HH__
+
+#include <stdint.h>
+#include <pthread.h>
+#include "cvlib.hh"
+#include "framePool.hh"
+
+// Writes frames from a dedicated thread, so that slow encoding or disk I/O never holds up the frame
+// thread. Frames are copied into a bounded queue of preallocated buffers, or, if they come from a
+// FramePool, queued by reference, without a copy. If the writer falls so far behind that the queue
+// is full, new frames are dropped (and counted) instead of blocking
+
+typedef void (AsyncFrameWriterCallback_t)(IplImage* frame, uint64_t timestamp_us);
+
+class AsyncFrameWriter
+{
+    pthread_t       thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t  haveFrames;
+    pthread_cond_t  drained;
+
+    IplImage**      slots;
+    PooledFrame**   pooled; // the frame in each slot, if it was queued by reference
+    uint64_t*       timestamps;
+    int             capacity;
+    int             head, count;
+    bool            running, quitting;
+    uint64_t        numDropped;
+
+    AsyncFrameWriterCallback_t* callback;
+
+    static void* threadEntry(void* cookie);
+    void         threadLoop(void);
+
+public:
+    AsyncFrameWriter();
+    ~AsyncFrameWriter();
+
+    bool start(int w, int h, int queueLength, AsyncFrameWriterCallback_t* _callback);
+
+    // writes everything that's queued, then stops the writer thread
+    void stop(void);
+
+    // queues a copy of the frame. Returns false if the queue was full and the frame was dropped
+    bool push(const IplImage* frame, uint64_t timestamp_us);
+
+    // queues a reference to the frame, which is released once it's written. Returns false if the
+    // queue was full and the frame was dropped
+    bool pushPooled(PooledFrame* frame);
+
+    // These may be called from any thread
+    bool     isRunning(void);
+    int      getQueueDepth(void);
+    int      getCapacity(void);
+    uint64_t getNumDropped(void);
+};
+
+#endif
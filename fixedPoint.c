@@ -0,0 +1,224 @@
+#include <math.h>
+#include <string.h>
+#include "fixedPoint.h"
+#include "recursiveGaussian.h"
+
+// the reciprocal table is indexed by den rounded to 4 fractional bits, by shifting out the rest
+#define RECIPROCAL_INDEX_SHIFT (FIXED_POINT_SHIFT - 4)
+#define RECIPROCAL_SHIFT       20
+#define NUM_RECIPROCALS        ((0xffff >> RECIPROCAL_INDEX_SHIFT) + 2)
+
+#define ROW(m, type, y) ((type*)((m)->data.ptr + (y)*(m)->step))
+
+void fixedPointConvert(const CvMat* src, CvMat* dst)
+{
+    for(int y=0; y<src->rows; y++)
+    {
+        const uint8_t* in  = ROW(src, const uint8_t, y);
+        uint16_t*      out = ROW(dst, uint16_t,      y);
+        for(int x=0; x<src->cols; x++)
+            out[x] = (uint16_t)in[x] << FIXED_POINT_SHIFT;
+    }
+}
+
+// The kernel cvSmooth() uses: OpenCV's fixed tables for the small widths, and a sampled Gaussian
+// otherwise, with the weights as 0.16 fixed point. The center weight is whatever the others leave of
+// 1, so that they sum to exactly 1, and flat areas stay flat
+static void getKernel(int w, uint16_t* kernel)
+{
+    static const double small[4][7] =
+        { {1},
+          {0.25, 0.5, 0.25},
+          {0.0625, 0.25, 0.375, 0.25, 0.0625},
+          {0.03125, 0.109375, 0.21875, 0.28125, 0.21875, 0.109375, 0.03125} };
+
+    double weights[FIXED_POINT_MAX_KERNEL_W];
+    if(w <= 7)
+        for(int i=0; i<w; i++)
+            weights[i] = small[w/2][i];
+    else
+    {
+        double sigma = getGaussianSigma(w);
+        double sum   = 0.0;
+        for(int i=0; i<w; i++)
+        {
+            double x = i - (w-1)/2;
+            weights[i] = exp(-x*x / (2.0*sigma*sigma));
+            sum += weights[i];
+        }
+        for(int i=0; i<w; i++)
+            weights[i] /= sum;
+    }
+
+    int32_t sum = 0;
+    for(int i=0; i<w; i++)
+        if(i != w/2)
+        {
+            kernel[i] = (uint16_t)lrint(weights[i] * 65536.0);
+            sum += kernel[i];
+        }
+    kernel[w/2] = 65536 - sum;
+}
+
+// cvSmooth()'s BORDER_REPLICATE: ... 0 0 | 0 1 2 ... n-1 | n-1 n-1 ...
+static int replicateIndex(int i, int n)
+{
+    if(i < 0)  return 0;
+    if(i >= n) return n - 1;
+    return i;
+}
+
+// the high 16 bits of a 16x16-bit product. This is a single instruction on 8 pixels at once
+// (pmulhuw), which is what makes the 16-bit path faster than the float one
+static inline uint16_t mulhi(uint16_t a, uint16_t b)
+{
+    return ((uint32_t)a * b) >> 16;
+}
+
+// One axis of the filter. out[x] = sum(k[j] * rows[j][x]), with the taps taken from the rows given.
+// Each output row is accumulated one tap at a time over the whole row, so the inner loops run along
+// x and vectorize. Each product is truncated to 16 bits, which loses half a unit on average; I add
+// that back up front
+static void filterTaps(const uint16_t* const* rows, const uint16_t* k, int w, int n, uint16_t* out)
+{
+    uint16_t bias = w/2;
+    for(int x=0; x<n; x++)
+        out[x] = bias + mulhi(rows[0][x], k[0]);
+    for(int j=1; j<w; j++)
+    {
+        const uint16_t* restrict row = rows[j];
+        const uint16_t           kj  = k[j];
+        for(int x=0; x<n; x++)
+            out[x] += mulhi(row[x], kj);
+    }
+}
+
+typedef void filterTaps_t(const uint16_t* const* rows, const uint16_t* k, int w, int n, uint16_t* out);
+
+// filterTaps() with the width fixed at compile time. With w known, the taps unroll completely, the
+// row pointers and weights stay in registers, and each output pixel is accumulated in a register
+// instead of in out[] one tap at a time. The sums are the same, in the same order, so the result is
+// identical to filterTaps()
+#define DEFINE_FILTER_TAPS(W)                                                               \
+static void filterTaps##W(const uint16_t* const* rows, const uint16_t* k, int w, int n,   \
+                          uint16_t* restrict out)                                           \
+{                                                                                           \
+    (void)w;                                                                                \
+    const uint16_t* restrict r[W];                                                          \
+    uint16_t                 kr[W];                                                         \
+    for(int j=0; j<W; j++)                                                                  \
+    {                                                                                       \
+        r[j]  = rows[j];                                                                    \
+        kr[j] = k[j];                                                                       \
+    }                                                                                       \
+                                                                                            \
+    for(int x=0; x<n; x++)                                                                  \
+    {                                                                                       \
+        uint16_t sum = W/2;                                                                 \
+        _Pragma("GCC unroll 64")                                                            \
+        for(int j=0; j<W; j++)                                                              \
+            sum += mulhi(r[j][x], kr[j]);                                                   \
+        out[x] = sum;                                                                       \
+    }                                                                                       \
+}
+
+// The widths worm3 runs with: the presmoothing and adaptive-threshold range around their defaults,
+// the default detrending width, and what --downsample 2 and 4 scale those to
+DEFINE_FILTER_TAPS(3)
+DEFINE_FILTER_TAPS(5)
+DEFINE_FILTER_TAPS(7)
+DEFINE_FILTER_TAPS(9)
+DEFINE_FILTER_TAPS(11)
+DEFINE_FILTER_TAPS(13)
+DEFINE_FILTER_TAPS(15)
+DEFINE_FILTER_TAPS(19)
+DEFINE_FILTER_TAPS(37)
+
+// indexed by w/2. The other widths use the generic filterTaps()
+static filterTaps_t* const specializedFilterTaps[] =
+    { NULL,          filterTaps3,  filterTaps5,  filterTaps7,  filterTaps9,
+      filterTaps11,  filterTaps13, filterTaps15, NULL,         filterTaps19,
+      NULL,          NULL,         NULL,         NULL,         NULL,
+      NULL,          NULL,         NULL,         filterTaps37 };
+
+static filterTaps_t* getFilterTaps(int w)
+{
+    int i = w/2;
+    if(i < (int)(sizeof(specializedFilterTaps)/sizeof(specializedFilterTaps[0])) &&
+       specializedFilterTaps[i] != NULL)
+        return specializedFilterTaps[i];
+    return filterTaps;
+}
+
+void fixedPointGaussian(const CvMat* src, CvMat* dst, CvMat* scratch, CvMat* lineScratch, int w)
+{
+    int width = src->cols, height = src->rows;
+    w = MIN(w | 1, FIXED_POINT_MAX_KERNEL_W);
+    int r = w/2;
+
+    if(w == 1)
+    {
+        if(src != dst)
+            cvCopy(src, dst, NULL);
+        return;
+    }
+
+    uint16_t kernel[FIXED_POINT_MAX_KERNEL_W];
+    getKernel(w, kernel);
+    filterTaps_t* taps = getFilterTaps(w);
+
+    const uint16_t* rows[FIXED_POINT_MAX_KERNEL_W];
+    uint16_t* line = (uint16_t*)lineScratch->data.ptr;
+
+    for(int y=0; y<height; y++)
+    {
+        const uint16_t* in = ROW(src, const uint16_t, y);
+        memcpy(&line[r], in, width*sizeof(uint16_t));
+        for(int i=0; i<r; i++)
+        {
+            line[i]             = in[replicateIndex(i - r,     width)];
+            line[width + r + i] = in[replicateIndex(width + i, width)];
+        }
+
+        for(int j=0; j<w; j++)
+            rows[j] = &line[j];
+        taps(rows, kernel, w, width, ROW(scratch, uint16_t, y));
+    }
+
+    for(int y=0; y<height; y++)
+    {
+        for(int j=0; j<w; j++)
+            rows[j] = ROW(scratch, const uint16_t, replicateIndex(y - r + j, height));
+        taps(rows, kernel, w, width, ROW(dst, uint16_t, y));
+    }
+}
+
+void fixedPointDivide(const CvMat* num, const CvMat* den, CvMat* dst, double scale)
+{
+    // reciprocals[i] = scale / (i / 2^(FIXED_POINT_SHIFT - RECIPROCAL_INDEX_SHIFT)), relative to
+    // num, with RECIPROCAL_SHIFT fractional bits. Each thread keeps its own table, so that vision
+    // contexts in different threads can divide with different scales
+    static __thread uint32_t reciprocals[NUM_RECIPROCALS];
+    static __thread double   reciprocalsScale = -1.0;
+    if(scale != reciprocalsScale)
+    {
+        reciprocals[0] = 0;
+        for(int i=1; i<NUM_RECIPROCALS; i++)
+            reciprocals[i] = (uint32_t)lrint(scale * (double)(1 << RECIPROCAL_SHIFT) /
+                                             (double)(i << RECIPROCAL_INDEX_SHIFT));
+        reciprocalsScale = scale;
+    }
+
+    for(int y=0; y<num->rows; y++)
+    {
+        const uint16_t* a   = ROW(num, const uint16_t, y);
+        const uint16_t* b   = ROW(den, const uint16_t, y);
+        uint8_t*        out = ROW(dst, uint8_t,        y);
+        for(int x=0; x<num->cols; x++)
+        {
+            int      i = (b[x] + (1 << (RECIPROCAL_INDEX_SHIFT-1))) >> RECIPROCAL_INDEX_SHIFT;
+            uint64_t q = ((uint64_t)a[x] * reciprocals[i] + (1 << (RECIPROCAL_SHIFT-1))) >> RECIPROCAL_SHIFT;
+            out[x] = q > 255 ? 255 : q;
+        }
+    }
+}
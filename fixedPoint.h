@@ -0,0 +1,37 @@
+#ifndef __FIXED_POINT_H__
+#define __FIXED_POINT_H__
+
+#include <stdint.h>
+#include "cvlib.hh"
+
+// The integer versions of the float stages of isolateWorms(). The images are CV_16UC1 holding 8.8
+// fixed-point values: an 8-bit pixel p is stored as p << FIXED_POINT_SHIFT. Half the size of the
+// CV_32FC1 planes, so each pass moves half the memory, and twice as many pixels fit in a vector
+
+#define FIXED_POINT_SHIFT 8
+
+// the kernel is accumulated in 16 bits, with a bias of up to FIXED_POINT_MAX_KERNEL_W/2 units. This
+// keeps that below the headroom above 255 << FIXED_POINT_SHIFT
+#define FIXED_POINT_MAX_KERNEL_W 511
+
+// 8-bit image to 8.8 fixed point
+void fixedPointConvert(const CvMat* src, CvMat* dst);
+
+// cvSmooth(src, dst, CV_GAUSSIAN, w, w, 0, 0), with the same kernel and the same (replicated) border,
+// but with 0.16 fixed-point weights, accumulated in 16 bits. This is within a tenth of an 8-bit
+// level of the float result for w up to 111. The widths worm3 uses run through kernels unrolled for
+// that width at compile time, which give the same result about twice as fast. The horizontal pass
+// goes into scratch, which must be the size of src. src and dst may be the same, and any of them may
+// be views. lineScratch holds each row padded with its border: a CV_16UC1 row at least
+// src->cols + FIXED_POINT_MAX_KERNEL_W - 1 wide. Wider kernels are narrowed to
+// FIXED_POINT_MAX_KERNEL_W
+void fixedPointGaussian(const CvMat* src, CvMat* dst, CvMat* scratch, CvMat* lineScratch, int w);
+
+// dst = saturate(round(scale * num / den)), an 8-bit image, as cvDiv() followed by cvConvert() does.
+// Instead of dividing, I multiply by a table of reciprocals of den, rounded to 4 fractional bits.
+// The background den is mostly much brighter than that step, so this costs well under one 8-bit
+// level in the result. Like cvDiv() where den is 0, the result is 0 where den rounds to 0. The table
+// is rebuilt whenever scale changes
+void fixedPointDivide(const CvMat* num, const CvMat* den, CvMat* dst, double scale);
+
+#endif
@@ -0,0 +1,193 @@
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "frameArchive.hh"
+
+static uint32_t getRecordSize(int w, int h)
+{
+    uint32_t pixelsSize = (w*h + FRAME_ARCHIVE_ALIGNMENT - 1) & ~(FRAME_ARCHIVE_ALIGNMENT - 1);
+    return FRAME_ARCHIVE_RECORD_HEADER_SIZE + pixelsSize;
+}
+
+FrameArchiveWriter::FrameArchiveWriter()
+    : fp(NULL), width(0), height(0), recordSize(0), numFrames(0)
+{
+}
+
+FrameArchiveWriter::~FrameArchiveWriter()
+{
+    close();
+}
+
+bool FrameArchiveWriter::open(const char* filename, int w, int h)
+{
+    close();
+
+    fp = fopen(filename, "wb");
+    if(fp == NULL)
+        return false;
+
+    width      = w;
+    height     = h;
+    recordSize = getRecordSize(w, h);
+    numFrames  = 0;
+
+    unsigned char header[FRAME_ARCHIVE_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, FRAME_ARCHIVE_MAGIC, 8);
+
+    uint32_t dims[3] = { (uint32_t)w, (uint32_t)h, recordSize };
+    memcpy(&header[8], dims, sizeof(dims));
+
+    if(fwrite(header, sizeof(header), 1, fp) != 1)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void FrameArchiveWriter::close(void)
+{
+    if(fp != NULL)
+    {
+        fclose(fp);
+        fp = NULL;
+    }
+}
+
+bool FrameArchiveWriter::writeFrame(const IplImage* frame, uint64_t timestamp_us)
+{
+    if(fp == NULL || frame->width != width || frame->height != height)
+        return false;
+
+    unsigned char recordHeader[FRAME_ARCHIVE_RECORD_HEADER_SIZE];
+    memset(recordHeader, 0, sizeof(recordHeader));
+    uint64_t fields[2] = { timestamp_us, numFrames };
+    memcpy(recordHeader, fields, sizeof(fields));
+
+    if(fwrite(recordHeader, sizeof(recordHeader), 1, fp) != 1)
+        return false;
+
+    for(int y=0; y<height; y++)
+        if(fwrite(frame->imageData + y*frame->widthStep, width, 1, fp) != 1)
+            return false;
+
+    static const unsigned char padding[FRAME_ARCHIVE_ALIGNMENT] = {};
+    size_t paddingSize = recordSize - FRAME_ARCHIVE_RECORD_HEADER_SIZE - width*height;
+    if(paddingSize && fwrite(padding, paddingSize, 1, fp) != 1)
+        return false;
+
+    numFrames++;
+    return true;
+}
+
+FrameArchiveSource::FrameArchiveSource(const char* filename)
+    : FrameSource(FRAMESOURCE_GRAYSCALE),
+      map(NULL), mapSize(0), recordSize(0), numFrames(0), currentFrame(0)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+        return;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < FRAME_ARCHIVE_HEADER_SIZE)
+    {
+        ::close(fd);
+        return;
+    }
+
+    void* m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(m == MAP_FAILED)
+        return;
+
+    const unsigned char* header = (const unsigned char*)m;
+    uint32_t dims[3];
+    memcpy(dims, &header[8], sizeof(dims));
+
+    if(memcmp(header, FRAME_ARCHIVE_MAGIC, 8) != 0 ||
+       dims[2] != getRecordSize(dims[0], dims[1]))
+    {
+        munmap(m, st.st_size);
+        return;
+    }
+
+    map        = header;
+    mapSize    = st.st_size;
+    width      = dims[0];
+    height     = dims[1];
+    recordSize = dims[2];
+    numFrames  = (mapSize - FRAME_ARCHIVE_HEADER_SIZE) / recordSize;
+}
+
+FrameArchiveSource::~FrameArchiveSource()
+{
+    cleanupThreads();
+    stopPooledSourceThread();
+
+    if(map != NULL)
+        munmap((void*)map, mapSize);
+}
+
+bool FrameArchiveSource::_getNextFrame(uint64_t* timestamp_us, IplImage* image)
+{
+    if(currentFrame >= numFrames)
+        return false;
+
+    const unsigned char* record = getRecord(currentFrame);
+    memcpy(timestamp_us, record, sizeof(*timestamp_us));
+
+    const unsigned char* pixels = record + FRAME_ARCHIVE_RECORD_HEADER_SIZE;
+    if(image->widthStep == width)
+        memcpy(image->imageData, pixels, width*height);
+    else
+        for(int y=0; y<height; y++)
+            memcpy(image->imageData + y*image->widthStep, pixels + y*width, width);
+
+    currentFrame++;
+    return true;
+}
+
+bool FrameArchiveSource::_getLatestFrame(uint64_t* timestamp_us, IplImage* image)
+{
+    return _getNextFrame(timestamp_us, image);
+}
+
+PooledFrame* FrameArchiveSource::_getNextPooledFrame(FramePool* pool)
+{
+    if(currentFrame >= numFrames)
+        return NULL;
+
+    const unsigned char* record = getRecord(currentFrame);
+    PooledFrame*         frame  = pool->wrap(record + FRAME_ARCHIVE_RECORD_HEADER_SIZE, width);
+    memcpy(&frame->timestamp_us, record, sizeof(frame->timestamp_us));
+
+    currentFrame++;
+    return frame;
+}
+
+bool FrameArchiveSource::restartStream(void)
+{
+    return seekFrame(0);
+}
+
+bool FrameArchiveSource::seekFrame(uint64_t frame)
+{
+    if(frame >= numFrames)
+        return false;
+
+    currentFrame = frame;
+    return true;
+}
+
+bool FrameArchiveSource::getFrameTimestamp(uint64_t frame, uint64_t* timestamp_us)
+{
+    if(frame >= numFrames)
+        return false;
+
+    memcpy(timestamp_us, getRecord(frame), sizeof(*timestamp_us));
+    return true;
+}
@@ -0,0 +1,86 @@
+#ifndef __FRAME_ARCHIVE_HH__
+#define __FRAME_ARCHIVE_HH__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "frameSource.hh"
+#include "framePool.hh"
+
+// A simple uncompressed store of grayscale frames. Every frame is stored in a fixed-size record, so
+// the location of frame i is computed directly, and any frame can be read back with a single copy
+// out of a memory-mapped file. The layout is
+//
+//   header (FRAME_ARCHIVE_HEADER_SIZE bytes):
+//     char     magic[8] = "WORMFRM1"
+//     uint32_t width, height
+//     uint32_t recordSize
+//   record i, at FRAME_ARCHIVE_HEADER_SIZE + i*recordSize:
+//     uint64_t timestamp_us
+//     uint64_t frame index
+//     padding up to FRAME_ARCHIVE_RECORD_HEADER_SIZE bytes
+//     width*height pixels, rows packed, padded to a multiple of FRAME_ARCHIVE_ALIGNMENT
+//
+// All values are stored in the native byte order. The number of frames is implied by the file size,
+// so an archive that was not closed cleanly is still readable up to its last complete record
+
+#define FRAME_ARCHIVE_MAGIC              "WORMFRM1"
+#define FRAME_ARCHIVE_ALIGNMENT          64
+#define FRAME_ARCHIVE_HEADER_SIZE        FRAME_ARCHIVE_ALIGNMENT
+#define FRAME_ARCHIVE_RECORD_HEADER_SIZE FRAME_ARCHIVE_ALIGNMENT
+#define FRAME_ARCHIVE_EXTENSION          ".frames"
+
+class FrameArchiveWriter
+{
+    FILE*    fp;
+    int      width, height;
+    uint32_t recordSize;
+    uint64_t numFrames;
+
+public:
+    FrameArchiveWriter();
+    ~FrameArchiveWriter();
+
+    bool open(const char* filename, int w, int h);
+    void close(void);
+    bool writeFrame(const IplImage* frame, uint64_t timestamp_us);
+
+    operator bool() { return fp != NULL; }
+};
+
+class FrameArchiveSource : public FrameSource, public PooledFrameSource
+{
+    const unsigned char* map;
+    size_t               mapSize;
+    uint32_t             recordSize;
+    uint64_t             numFrames;
+    uint64_t             currentFrame;
+
+    const unsigned char* getRecord(uint64_t frame)
+    {
+        return map + FRAME_ARCHIVE_HEADER_SIZE + frame*recordSize;
+    }
+
+protected:
+    // a stored archive has no notion of a "latest" frame, so both of these return the next one
+    bool _getNextFrame  (uint64_t* timestamp_us, IplImage* image);
+    bool _getLatestFrame(uint64_t* timestamp_us, IplImage* image);
+
+    // the frame wraps its record in the mapping, without copying it
+    PooledFrame* _getNextPooledFrame(FramePool* pool);
+
+public:
+    FrameArchiveSource(const char* filename);
+    ~FrameArchiveSource();
+
+    operator bool() { return map != NULL; }
+
+    bool     restartStream(void);
+    uint64_t getNumFrames(void) { return numFrames; }
+
+    // random access: the next frame returned will be frame number 'frame'. Both return false if
+    // there's no such frame
+    bool     seekFrame(uint64_t frame);
+    bool     getFrameTimestamp(uint64_t frame, uint64_t* timestamp_us);
+};
+
+#endif
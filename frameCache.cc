@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frameCache.hh"
+
+FrameCacheSource::FrameCacheSource(FrameSource* source, int first, int count, size_t maxBytes)
+    : FrameSource(FRAMESOURCE_GRAYSCALE),
+      cachedSource(source), pixels(NULL), timestamps(NULL), numFrames(0), currentFrame(0)
+{
+    width  = source->w();
+    height = source->h();
+
+    size_t frameSize = (size_t)width * height;
+    int    maxFrames = frameSize == 0 ? 0 : (int)(maxBytes / frameSize);
+    if(count > 0 && count < maxFrames)
+        maxFrames = count;
+    if(maxFrames <= 0)
+        return;
+
+    pixels     = (unsigned char*)malloc(maxFrames * frameSize);
+    timestamps = (uint64_t*)     malloc(maxFrames * sizeof(timestamps[0]));
+    if(pixels == NULL || timestamps == NULL)
+    {
+        fprintf(stderr, "couldn't allocate a frame cache of %d frames\n", maxFrames);
+        return;
+    }
+
+    IplImage* frame = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, 1);
+
+    uint64_t timestamp_us;
+    bool     haveFrame = true;
+    for(int i=0; i<first && haveFrame; i++)
+        haveFrame = source->getNextFrame(&timestamp_us, frame);
+
+    while(haveFrame && numFrames < maxFrames &&
+          source->getNextFrame(&timestamps[numFrames], frame))
+    {
+        unsigned char* dst = pixels + numFrames*frameSize;
+        if(frame->widthStep == width)
+            memcpy(dst, frame->imageData, frameSize);
+        else
+            for(int y=0; y<height; y++)
+                memcpy(dst + y*width, frame->imageData + y*frame->widthStep, width);
+        numFrames++;
+    }
+    cvReleaseImage(&frame);
+
+    if(numFrames == 0)
+        fprintf(stderr, "the source has no frames past frame %d to cache\n", first);
+    else if(numFrames == maxFrames && (count == 0 || numFrames < count))
+        fprintf(stderr, "frame cache: %d frames of %dx%d fill the %zu MB budget. Caching only those\n",
+                numFrames, width, height, maxBytes >> 20);
+}
+
+FrameCacheSource::~FrameCacheSource()
+{
+    cleanupThreads();
+    stopPooledSourceThread();
+
+    free(pixels);
+    free(timestamps);
+    delete cachedSource;
+}
+
+bool FrameCacheSource::_getNextFrame(uint64_t* timestamp_us, IplImage* image)
+{
+    if(currentFrame >= numFrames)
+        return false;
+
+    *timestamp_us = timestamps[currentFrame];
+
+    const unsigned char* src = pixels + (size_t)currentFrame*width*height;
+    if(image->widthStep == width)
+        memcpy(image->imageData, src, width*height);
+    else
+        for(int y=0; y<height; y++)
+            memcpy(image->imageData + y*image->widthStep, src + y*width, width);
+
+    currentFrame++;
+    return true;
+}
+
+bool FrameCacheSource::_getLatestFrame(uint64_t* timestamp_us, IplImage* image)
+{
+    return _getNextFrame(timestamp_us, image);
+}
+
+PooledFrame* FrameCacheSource::_getNextPooledFrame(FramePool* pool)
+{
+    if(currentFrame >= numFrames)
+        return NULL;
+
+    PooledFrame* frame = pool->wrap(pixels + (size_t)currentFrame*width*height, width);
+    frame->timestamp_us = timestamps[currentFrame];
+
+    currentFrame++;
+    return frame;
+}
+
+bool FrameCacheSource::restartStream(void)
+{
+    currentFrame = 0;
+    return numFrames > 0;
+}
@@ -0,0 +1,46 @@
+#ifndef __FRAME_CACHE_HH__
+#define __FRAME_CACHE_HH__
+
+#include <stdint.h>
+#include "frameSource.hh"
+#include "framePool.hh"
+
+// A window of a stored video, decoded once and then played back from memory. Tuning the vision
+// parameters on a recording loops over the same few seconds of it many times, and without this
+// every loop decodes them again. The constructor reads frames first .. first+count-1 of the given
+// source (up to its end, if count is 0) into a single buffer, stopping early if the next frame
+// would take it past maxBytes. After that the frames come out of the buffer, with their original
+// timestamps. As at the end of a file, _getNextFrame() fails after the last cached frame, and
+// restartStream() goes back to the first one.
+//
+// The cache owns the source it reads, and deletes it when it's deleted. The source isn't read from
+// again after the constructor, but it's kept around for getCachedSource()
+class FrameCacheSource : public FrameSource, public PooledFrameSource
+{
+    FrameSource*   cachedSource;
+    unsigned char* pixels;
+    uint64_t*      timestamps;
+    int            numFrames;
+    int            currentFrame;
+
+protected:
+    // a cached window has no notion of a "latest" frame, so both of these return the next one
+    bool _getNextFrame  (uint64_t* timestamp_us, IplImage* image);
+    bool _getLatestFrame(uint64_t* timestamp_us, IplImage* image);
+
+    // the frame wraps its place in the cache, without copying it
+    PooledFrame* _getNextPooledFrame(FramePool* pool);
+
+public:
+    FrameCacheSource(FrameSource* source, int first, int count, size_t maxBytes);
+    ~FrameCacheSource();
+
+    operator bool() { return numFrames > 0; }
+
+    bool restartStream(void);
+    int  getNumFrames(void) { return numFrames; }
+
+    FrameSource* getCachedSource(void) { return cachedSource; }
+};
+
+#endif
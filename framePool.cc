@@ -0,0 +1,136 @@
+#include "framePool.hh"
+
+void PooledFrame::retain(void)
+{
+    __sync_add_and_fetch(&refcount, 1);
+}
+
+void PooledFrame::release(void)
+{
+    if(__sync_sub_and_fetch(&refcount, 1) == 0)
+        pool->put(this);
+}
+
+FramePool::FramePool(int w, int h, int _numFrames)
+    : numFrames(_numFrames), numFree(_numFrames)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&available, NULL);
+
+    frames     = new PooledFrame [numFrames];
+    freeFrames = new PooledFrame*[numFrames];
+    for(int i=0; i<numFrames; i++)
+    {
+        PooledFrame* frame = &frames[i];
+        cvInitImageHeader(&frame->image, cvSize(w, h), IPL_DEPTH_8U, 1, IPL_ORIGIN_TL, 4);
+        frame->ownStep      = frame->image.widthStep;
+        frame->ownData      = new char[frame->ownStep * h];
+        cvSetData(&frame->image, frame->ownData, frame->ownStep);
+        frame->timestamp_us = 0;
+        frame->pool         = this;
+        frame->refcount     = 0;
+        freeFrames[i]       = frame;
+    }
+}
+
+FramePool::~FramePool()
+{
+    for(int i=0; i<numFrames; i++)
+        delete[] frames[i].ownData;
+    delete[] frames;
+    delete[] freeFrames;
+
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&available);
+}
+
+PooledFrame* FramePool::acquire(void)
+{
+    pthread_mutex_lock(&mutex);
+    while(numFree == 0)
+        pthread_cond_wait(&available, &mutex);
+    PooledFrame* frame = freeFrames[--numFree];
+    pthread_mutex_unlock(&mutex);
+
+    frame->refcount = 1;
+    return frame;
+}
+
+PooledFrame* FramePool::wrap(const unsigned char* pixels, int widthStep)
+{
+    PooledFrame* frame = acquire();
+    cvSetData(&frame->image, (void*)pixels, widthStep);
+    return frame;
+}
+
+void FramePool::put(PooledFrame* frame)
+{
+    // a wrapped frame gets its own buffer back
+    cvSetData(&frame->image, frame->ownData, frame->ownStep);
+
+    pthread_mutex_lock(&mutex);
+    freeFrames[numFree++] = frame;
+    pthread_cond_signal(&available);
+    pthread_mutex_unlock(&mutex);
+}
+
+PooledFrameSource::PooledFrameSource()
+    : threadRunning(false), threadPool(NULL), threadCallback(NULL), threadQuitting(false)
+{
+    pthread_mutex_init(&threadMutex, NULL);
+}
+
+PooledFrameSource::~PooledFrameSource()
+{
+    pthread_mutex_destroy(&threadMutex);
+}
+
+bool PooledFrameSource::isQuitting(void)
+{
+    pthread_mutex_lock(&threadMutex);
+    bool quitting = threadQuitting;
+    pthread_mutex_unlock(&threadMutex);
+    return quitting;
+}
+
+void* PooledFrameSource::threadEntry(void* cookie)
+{
+    PooledFrameSource* source = (PooledFrameSource*)cookie;
+    while(!source->isQuitting())
+    {
+        PooledFrame* frame = source->getNextPooledFrame(source->threadPool);
+        bool keepGoing = (*source->threadCallback)(frame);
+        if(frame != NULL)
+            frame->release();
+        if(!keepGoing)
+            break;
+    }
+    return NULL;
+}
+
+bool PooledFrameSource::startPooledSourceThread(PooledFrameCallback_t* callback, FramePool* pool)
+{
+    stopPooledSourceThread();
+
+    threadCallback = callback;
+    threadPool     = pool;
+    threadQuitting = false; // no thread is running to read it
+    if(pthread_create(&thread, NULL, &threadEntry, this) != 0)
+        return false;
+
+    threadRunning = true;
+    return true;
+}
+
+void PooledFrameSource::stopPooledSourceThread(void)
+{
+    if(!threadRunning)
+        return;
+
+    pthread_mutex_lock(&threadMutex);
+    threadQuitting = true;
+    pthread_mutex_unlock(&threadMutex);
+
+    pthread_join(thread, NULL);
+    threadRunning = false;
+}
@@ -0,0 +1,96 @@
+#ifndef __FRAME_POOL_HH__
+#define __FRAME_POOL_HH__
+
+#include <stdint.h>
+#include <pthread.h>
+#include "cvlib.hh"
+
+// Reference-counted frames, handed from a source to all the consumers of a frame (the vision, the
+// display, the recorder) without copying it. A frame is either one of the pool's own buffers, or a
+// header around memory the source already holds the frame in (a frame archive's mapping, a frame
+// cache), wrapped without copying. Either way, the pool bounds the number of frames in flight.
+//
+// A frame comes with one reference, held by whoever got it from the pool. A consumer that keeps the
+// frame past the call it was given the frame in takes a reference with retain(), and drops it with
+// release(). When the last reference is dropped, the frame goes back to the pool. The pixels are
+// read-only to the consumers: a wrapped frame may be a read-only mapping
+
+class FramePool;
+
+struct PooledFrame
+{
+    IplImage   image;
+    uint64_t   timestamp_us;
+
+    FramePool* pool;
+    char*      ownData;
+    int        ownStep;
+    int        refcount;
+
+    void retain(void);
+    void release(void);
+};
+
+class FramePool
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t  available;
+
+    PooledFrame*    frames;
+    PooledFrame**   freeFrames;
+    int             numFrames, numFree;
+
+    friend struct PooledFrame;
+    void put(PooledFrame* frame);
+
+public:
+    FramePool(int w, int h, int _numFrames);
+    ~FramePool();
+
+    // A free frame, holding the pool's own buffer. Blocks until one is free
+    PooledFrame* acquire(void);
+
+    // A free frame, holding the given pixels, which must stay valid and unchanged until the frame
+    // is released. Blocks until one is free
+    PooledFrame* wrap(const unsigned char* pixels, int widthStep);
+};
+
+// The frame callback of a PooledFrameSource's thread. The frame is NULL at the end of the stream,
+// as with FrameSource. The frame is released when the callback returns, so the callback retains it
+// to keep it. Returning false stops the thread
+typedef bool (PooledFrameCallback_t)(PooledFrame* frame);
+
+// A source that can hand out its frames from a FramePool, as an alternative to FrameSource's
+// getNextFrame() and startSourceThread(), which copy every frame into the caller's buffer. The
+// sources that implement this derive from both. The thread reads the frames back to back, as
+// FrameSource's does with no frame wait. A derived class must call stopPooledSourceThread() in its
+// destructor, as it calls cleanupThreads()
+class PooledFrameSource
+{
+    pthread_t              thread;
+    bool                   threadRunning;
+    FramePool*             threadPool;
+    PooledFrameCallback_t* threadCallback;
+
+    // set by stopPooledSourceThread(), and read by the thread, under the mutex
+    pthread_mutex_t        threadMutex;
+    bool                   threadQuitting;
+
+    static void* threadEntry(void* cookie);
+    bool isQuitting(void);
+
+protected:
+    // The next frame, or NULL at the end of the stream
+    virtual PooledFrame* _getNextPooledFrame(FramePool* pool) = 0;
+
+public:
+    PooledFrameSource();
+    virtual ~PooledFrameSource();
+
+    PooledFrame* getNextPooledFrame(FramePool* pool) { return _getNextPooledFrame(pool); }
+
+    bool startPooledSourceThread(PooledFrameCallback_t* callback, FramePool* pool);
+    void stopPooledSourceThread(void);
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include <time.h>
+#include <string.h>
+#include "frameStats.hh"
+
+#define FRAME_STATS_SUB_BUCKETS_LOG2 4
+#define FRAME_STATS_SUB_BUCKETS      (1 << FRAME_STATS_SUB_BUCKETS_LOG2)
+#define FRAME_STATS_NUM_BUCKETS      (FRAME_STATS_SUB_BUCKETS * (64 - FRAME_STATS_SUB_BUCKETS_LOG2 + 1))
+
+static const char* const stageNames[NUM_FRAME_STAGES] =
+    { "capture", "merge", "vision", "occupancy", "encode", "write", "plot", "lock_wait", "total", "sample_jitter" };
+
+struct histogram_t
+{
+    uint64_t counts[FRAME_STATS_NUM_BUCKETS];
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+};
+
+// Each thread that records anything gets one of these. They're linked into a list that is only ever
+// prepended to, so readers can walk it without locking. A histogram has a single writer, so readers
+// may see counts that are slightly stale, but never corrupted
+struct threadStats_t
+{
+    histogram_t    histograms[NUM_FRAME_STAGES];
+    threadStats_t* next;
+};
+
+static threadStats_t*          allThreadStats = NULL;
+static __thread threadStats_t* myThreadStats  = NULL;
+
+static uint64_t numFrames  = 0;
+static uint64_t numDropped = 0;
+static uint64_t numMissed  = 0;
+
+static int getBucket(uint64_t v)
+{
+    if(v < FRAME_STATS_SUB_BUCKETS)
+        return v;
+
+    int e = 63 - __builtin_clzll(v);
+    int sub = (v >> (e - FRAME_STATS_SUB_BUCKETS_LOG2)) & (FRAME_STATS_SUB_BUCKETS - 1);
+    return FRAME_STATS_SUB_BUCKETS * (e - FRAME_STATS_SUB_BUCKETS_LOG2 + 1) + sub;
+}
+
+// the middle of the range of values that map to a bucket
+static uint64_t getBucketValue(int bucket)
+{
+    if(bucket < FRAME_STATS_SUB_BUCKETS)
+        return bucket;
+
+    int e   = bucket / FRAME_STATS_SUB_BUCKETS - 1 + FRAME_STATS_SUB_BUCKETS_LOG2;
+    int sub = bucket % FRAME_STATS_SUB_BUCKETS;
+    uint64_t width = 1ull << (e - FRAME_STATS_SUB_BUCKETS_LOG2);
+    return (uint64_t)(FRAME_STATS_SUB_BUCKETS + sub) * width + width/2;
+}
+
+const char* frameStatsGetStageName(frameStage_t stage)
+{
+    return stageNames[stage];
+}
+
+static threadStats_t* getMyThreadStats(void)
+{
+    if(myThreadStats == NULL)
+    {
+        threadStats_t* stats = new threadStats_t;
+        memset(stats, 0, sizeof(*stats));
+
+        do
+            stats->next = allThreadStats;
+        while(!__sync_bool_compare_and_swap(&allThreadStats, stats->next, stats));
+
+        myThreadStats = stats;
+    }
+    return myThreadStats;
+}
+
+uint64_t frameStatsNow_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+void frameStatsRecord(frameStage_t stage, uint64_t duration_ns)
+{
+    histogram_t* h = &getMyThreadStats()->histograms[stage];
+
+    h->counts[getBucket(duration_ns)]++;
+    h->count++;
+    h->sum_ns += duration_ns;
+    if(duration_ns > h->max_ns)
+        h->max_ns = duration_ns;
+}
+
+void frameStatsCountFrame(void)
+{
+    __sync_fetch_and_add(&numFrames, 1);
+}
+
+void frameStatsCountDropped(uint64_t n)
+{
+    __sync_fetch_and_add(&numDropped, n);
+}
+
+void frameStatsCountMissedSamples(uint64_t n)
+{
+    __sync_fetch_and_add(&numMissed, n);
+}
+
+uint64_t frameStatsGetNumMissedSamples(void)
+{
+    return numMissed;
+}
+
+uint64_t frameStatsGetNumFrames(void)
+{
+    return numFrames;
+}
+
+uint64_t frameStatsGetNumDropped(void)
+{
+    return numDropped;
+}
+
+static uint64_t getPercentile(const histogram_t* h, double p)
+{
+    uint64_t target = (uint64_t)(p * h->count);
+    uint64_t seen   = 0;
+    for(int b=0; b<FRAME_STATS_NUM_BUCKETS; b++)
+    {
+        seen += h->counts[b];
+        if(seen > target)
+        {
+            uint64_t v = getBucketValue(b);
+            return v < h->max_ns ? v : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+void frameStatsSummarize(frameStage_t stage, frameStageSummary_t* summary)
+{
+    // merge the histograms of all the threads
+    histogram_t merged;
+    memset(&merged, 0, sizeof(merged));
+
+    for(threadStats_t* stats = allThreadStats; stats != NULL; stats = stats->next)
+    {
+        const histogram_t* h = &stats->histograms[stage];
+        for(int b=0; b<FRAME_STATS_NUM_BUCKETS; b++)
+            merged.counts[b] += h->counts[b];
+        merged.count  += h->count;
+        merged.sum_ns += h->sum_ns;
+        if(h->max_ns > merged.max_ns)
+            merged.max_ns = h->max_ns;
+    }
+
+    summary->count   = merged.count;
+    summary->max_ns  = merged.max_ns;
+    summary->mean_ns = merged.count ? (double)merged.sum_ns / merged.count : 0.0;
+    summary->p50_ns  = merged.count ? getPercentile(&merged, 0.50) : 0;
+    summary->p99_ns  = merged.count ? getPercentile(&merged, 0.99) : 0;
+}
+
+void frameStatsDump(FILE* fp)
+{
+    fprintf(fp, "# %-10s %10s %10s %10s %10s %10s\n",
+            "stage", "count", "p50_us", "p99_us", "max_us", "mean_us");
+
+    for(int stage=0; stage<NUM_FRAME_STAGES; stage++)
+    {
+        frameStageSummary_t s;
+        frameStatsSummarize((frameStage_t)stage, &s);
+        fprintf(fp, "  %-10s %10llu %10.1f %10.1f %10.1f %10.1f\n",
+                stageNames[stage], (unsigned long long)s.count,
+                s.p50_ns / 1e3, s.p99_ns / 1e3, s.max_ns / 1e3, s.mean_ns / 1e3);
+    }
+
+    fprintf(fp, "  frames %llu dropped %llu missed_samples %llu\n",
+            (unsigned long long)numFrames, (unsigned long long)numDropped,
+            (unsigned long long)numMissed);
+    fflush(fp);
+}
@@ -0,0 +1,80 @@
+#ifndef __FRAME_STATS_HH__
+#define __FRAME_STATS_HH__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "frameTrace.hh"
+
+// Latency statistics of the frame path. Each thread records into its own set of histograms, so
+// recording takes no locks and does no atomic operations. The histograms are log-linear: each
+// power-of-two range of durations is split into FRAME_STATS_SUB_BUCKETS linear buckets, so any
+// reported latency is within ~6% of the true value
+
+enum frameStage_t
+{
+    FRAME_STAGE_CAPTURE,     // time spent in the frame source between callbacks
+    FRAME_STAGE_MERGE,       // copying the frame into the display widget
+    FRAME_STAGE_VISION,      // isolateWorms()
+    FRAME_STAGE_OCCUPANCY,   // computeArenaOccupancy()
+    FRAME_STAGE_ENCODE,      // queueing the frame for recording, and writing the masks
+    FRAME_STAGE_WRITE,       // encoding and writing a queued frame, in the recording thread
+    FRAME_STAGE_PLOT,        // updating the plot and the accumulators
+    FRAME_STAGE_LOCK_WAIT,   // waiting for the FLTK lock in the source thread
+    FRAME_STAGE_TOTAL,       // the whole frame callback
+
+    // not a stage, but tracked the same way: how far each sample was from its deadline
+    FRAME_STAGE_SAMPLE_JITTER,
+
+    NUM_FRAME_STAGES
+};
+
+struct frameStageSummary_t
+{
+    uint64_t count;
+    uint64_t p50_ns, p99_ns, max_ns;
+    double   mean_ns;
+};
+
+uint64_t    frameStatsNow_ns(void);
+const char* frameStatsGetStageName(frameStage_t stage);
+
+void frameStatsRecord     (frameStage_t stage, uint64_t duration_ns);
+void frameStatsCountFrame (void);
+void frameStatsCountDropped(uint64_t numDropped);
+void frameStatsCountMissedSamples(uint64_t numMissed);
+
+uint64_t frameStatsGetNumFrames (void);
+uint64_t frameStatsGetNumDropped(void);
+uint64_t frameStatsGetNumMissedSamples(void);
+void     frameStatsSummarize(frameStage_t stage, frameStageSummary_t* summary);
+
+// writes a human-readable table of all the stages
+void frameStatsDump(FILE* fp);
+
+// Times the enclosing scope, or until end() is called. The span is also sent to the timeline trace,
+// if that's enabled
+class FrameStatsSpan
+{
+    frameStage_t stage;
+    uint64_t     t0_ns;
+
+public:
+    FrameStatsSpan(frameStage_t _stage) : stage(_stage)
+    {
+        frameTraceBegin(frameStatsGetStageName(stage));
+        t0_ns = frameStatsNow_ns();
+    }
+    ~FrameStatsSpan() { end(); }
+
+    void end(void)
+    {
+        if(t0_ns != 0)
+        {
+            frameStatsRecord(stage, frameStatsNow_ns() - t0_ns);
+            frameTraceEnd(frameStatsGetStageName(stage));
+            t0_ns = 0;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "frameTrace.hh"
+
+struct traceEvent_t
+{
+    const char* name;
+    uint64_t    timestamp_ns;
+    int         tid;
+    char        phase; // 'B' or 'E'
+
+    // set last, once the event is complete. Events not yet written are skipped. Like enabled, this
+    // is written and read with __atomic builtins, since the recording threads and the writer share it
+    bool        valid;
+};
+
+static traceEvent_t*   events    = NULL;
+static uint32_t        numEvents = 0;
+static uint64_t        nextEvent = 0;
+static bool            enabled   = false;
+static __thread int    myTid     = 0;
+
+static uint64_t getTime_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+bool frameTraceStart(uint32_t _numEvents)
+{
+    if(events != NULL || _numEvents == 0)
+        return false;
+
+    events    = new traceEvent_t[_numEvents];
+    numEvents = _numEvents;
+    for(uint32_t i=0; i<numEvents; i++)
+        events[i].valid = false;
+
+    // the release publishes the ring to the threads that see tracing enabled
+    __atomic_store_n(&enabled, true, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool frameTraceIsEnabled(void)
+{
+    return __atomic_load_n(&enabled, __ATOMIC_ACQUIRE);
+}
+
+static void recordEvent(const char* name, char phase)
+{
+    if(!__atomic_load_n(&enabled, __ATOMIC_ACQUIRE))
+        return;
+
+    if(myTid == 0)
+        myTid = syscall(SYS_gettid);
+
+    traceEvent_t* e = &events[__sync_fetch_and_add(&nextEvent, 1) % numEvents];
+    __atomic_store_n(&e->valid, false, __ATOMIC_RELAXED);
+    __sync_synchronize();
+    e->name         = name;
+    e->timestamp_ns = getTime_ns();
+    e->tid          = myTid;
+    e->phase        = phase;
+    __atomic_store_n(&e->valid, true, __ATOMIC_RELEASE);
+}
+
+void frameTraceBegin(const char* name)
+{
+    recordEvent(name, 'B');
+}
+
+void frameTraceEnd(const char* name)
+{
+    recordEvent(name, 'E');
+}
+
+bool frameTraceWrite(const char* filename)
+{
+    if(events == NULL)
+        return false;
+
+    __atomic_store_n(&enabled, false, __ATOMIC_SEQ_CST);
+
+    FILE* fp = fopen(filename, "w");
+    if(fp == NULL)
+        return false;
+
+    // If the ring wrapped, the oldest events were overwritten, and some 'E' events may have lost
+    // their 'B'. The viewers handle that fine
+    uint64_t end   = __atomic_load_n(&nextEvent, __ATOMIC_ACQUIRE);
+    uint64_t start = end > numEvents ? end - numEvents : 0;
+
+    fprintf(fp, "{\"traceEvents\":[\n");
+    bool first = true;
+    for(uint64_t i = start; i < end; i++)
+    {
+        const traceEvent_t* e = &events[i % numEvents];
+        if(!__atomic_load_n(&e->valid, __ATOMIC_ACQUIRE))
+            continue;
+
+        fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+                first ? "" : ",\n",
+                e->name, e->phase, e->timestamp_ns / 1e3, (int)getpid(), e->tid);
+        first = false;
+    }
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    return fclose(fp) == 0;
+}
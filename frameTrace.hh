@@ -0,0 +1,32 @@
+#ifndef __FRAME_TRACE_HH__
+#define __FRAME_TRACE_HH__
+
+#include <stdint.h>
+
+// Opt-in timeline tracing. When enabled, begin/end events are recorded into a ring preallocated by
+// frameTraceStart(), overwriting the oldest events when full. frameTraceWrite() writes the ring as
+// Chrome Trace Event JSON, viewable in chrome://tracing or Perfetto. Recording an event is a few
+// atomic operations, and nothing at all when tracing is off
+
+#define FRAME_TRACE_DEFAULT_EVENTS (1 << 20)
+
+bool frameTraceStart(uint32_t numEvents);
+bool frameTraceIsEnabled(void);
+
+void frameTraceBegin(const char* name);
+void frameTraceEnd  (const char* name);
+
+// stops tracing and writes all the recorded events
+bool frameTraceWrite(const char* filename);
+
+// Traces the enclosing scope. The name must be a string literal, or otherwise outlive the trace
+class FrameTraceScope
+{
+    const char* name;
+
+public:
+    FrameTraceScope(const char* _name) : name(_name) { frameTraceBegin(name); }
+    ~FrameTraceScope()                                { frameTraceEnd  (name); }
+};
+
+#endif
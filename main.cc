@@ -1,11 +1,14 @@
 #include <unistd.h>
+#include <getopt.h>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <time.h>
 #include <string.h>
+#include <signal.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string>
 using namespace std;
 
@@ -13,6 +16,7 @@ using namespace std;
 #include <Fl/fl_ask.H>
 #include <FL/Fl_Double_Window.H>
 #include <FL/Fl_Output.H>
+#include <FL/Fl_Multiline_Output.H>
 #include <FL/Fl_Input.H>
 #include <FL/Fl_Button.H>
 #include <FL/Fl_File_Chooser.H>
@@ -21,19 +25,32 @@ using namespace std;
 #include <FL/Fl_Check_Button.H>
 #include <FL/Fl_Round_Button.H>
 #include <FL/Fl_Group.H>
+#include <FL/Fl_Scroll.H>
 #include "Fl_Rotated_Text/Fl_Rotated_Text.H"
 #include "cartesian/Cartesian.H"
 
 #include "cvFltkWidget.hh"
 #include "ffmpegInterface.hh"
 #include "cameraSource_IIDC.hh"
+#include "frameArchive.hh"
+#include "frameCache.hh"
+#include "framePool.hh"
+#include "syntheticSource.hh"
+#include "frameStats.hh"
+#include "frameTrace.hh"
+#include "asyncFrameWriter.hh"
+#include "toolCommon.hh"
 
 extern "C"
 {
 #include "wormProcessing.h"
+#include "maskArchive.h"
+#include "sampleScheduler.h"
+#include "arenaFile.h"
 }
 
-#define DATA_FRAME_RATE_FPS     1 /* I collect at 1 frame per second */
+#define DATA_FRAME_RATE_FPS     1 /* by default I collect at 1 frame per second */
+#define CAMERA_FRAME_RATE_FPS   15
 #define PREVIEW_FRAME_RATE_FPS  15
 #define VIDEO_ENCODING_FPS      15
 #define CIRCLE_RADIUS           52
@@ -41,6 +58,11 @@ extern "C"
 #define POINTED_CIRCLE_COLOR    CV_RGB(0, 0xFF, 0)
 #define DURATION_MIN            1 /* minutes */
 #define DURATION_MAX            300 /* minutes */
+#define ARENA_RECORDING_MARGIN  16  /* pixels of context kept around each circle */
+#define STATS_POLL_PERIOD_S     0.5
+#define STATS_FILE_PERIOD_S     10
+#define RECORDING_QUEUE_LENGTH  32 /* frames buffered between the frame thread and the recorder */
+#define DEFAULT_CACHE_MEMORY_MB 512
 
 #define FRAME_W        480
 #define FRAME_H        480
@@ -57,17 +79,61 @@ extern "C"
 #define ACCUM_H        30
 #define PARAM_SLIDER_W 180
 #define PARAM_SLIDER_H 25
+#define HUD_W          300
+#define HUD_H          (FRAME_H - HUD_Y)
+#define HUD_Y          (3*BUTTON_H)
+#define HUD_FONT_SIZE  12
+#define ACCUM_SCROLL_W (WINDOW_W - HUD_W - FRAME_W)
+#define ACCUM_SCROLL_H (2*ACCUM_H)
+#define HUD_UPDATE_PERIOD_S 0.5
+
+// Long runs at high sample rates produce far more points than the plot has pixels. I average
+// consecutive samples into bins so that the plot holds at most MAX_PLOT_POINTS points per line. The
+// .samples log has every sample
+#define MAX_PLOT_POINTS (2*PLOT_W)
 
 
 // due to a bug (most likely), the axis aren't drawn completely inside their box. Thus I leave a bit
 // of extra space to see the labels
 #define AXIS_EXTRA_SPACE 40
 
-#define AM_READING_CAMERA (dynamic_cast<CameraSource_IIDC*>(source) != NULL)
+// the synthetic source stands in for a camera, so it's treated as one
+#define AM_READING_CAMERA (dynamic_cast<CameraSource_IIDC*>(source) != NULL || \
+                           dynamic_cast<SyntheticSource*>  (source) != NULL)
+
+// The .avi files I write contain one frame per sample, encoded at VIDEO_ENCODING_FPS or at the
+// sample rate, so their timestamps don't reflect when the frames were captured. Every other source
+// has real timestamps. A frame cache keeps the timestamps of the source it read
+#define HAVE_REAL_TIMESTAMPS (dynamic_cast<FFmpegDecoder*>(getDecodingSource()) == NULL)
+
+// --cache-frames: the stored video is played back from memory
+#define AM_PLAYING_FRAME_CACHE (dynamic_cast<FrameCacheSource*>(source) != NULL)
+
+static FFmpegEncoder      videoEncoder;
+static FrameArchiveWriter frameArchive;
+
+// The video and frame archive are written from their own thread, so that a slow disk or encoder
+// doesn't stall the frame thread
+static AsyncFrameWriter   frameWriter;
 
-static FFmpegEncoder videoEncoder;
+// the rates are set on the commandline
+static double dataRate_hz    = DATA_FRAME_RATE_FPS;
+static double cameraRate_fps = CAMERA_FRAME_RATE_FPS;
 
 static FrameSource*     source;
+
+// The sources of this repo hand their frames out of a pool, by reference, so the vision, the display
+// and the recorder all read the frame where the source put it. currentPooledFrame is the frame
+// gotNewFrame() is looking at, if it came from the pool; it's only touched in the frame thread
+static FramePool*       framePool;
+static PooledFrame*     currentPooledFrame;
+
+// --cache-frames FIRST:COUNT and --cache-memory MB. COUNT == 0 caches up to the end of the video
+static bool   cacheFrames       = false;
+static int    cacheFirstFrame   = 0;
+static int    cacheNumFrames    = 0;
+static size_t cacheMaxBytes     = (size_t)DEFAULT_CACHE_MEMORY_MB << 20;
+
 static CvFltkWidget*    widgetImage;
 static Fl_Button*       goResetButton;
 static Fl_Button*       chdirButton;
@@ -77,6 +143,8 @@ static Ca_Canvas*       plot = NULL;
 static Ca_X_Axis*       Xaxis;
 static Ca_Y_Axis*       Yaxis;
 static Fl_Check_Button* showProcessedVision;
+static Fl_Check_Button* showPerformance;
+static Fl_Multiline_Output* performanceHud;
 static Fl_Group*        circleOrientation;
 static Fl_Round_Button* orientationLeftRight;
 
@@ -88,30 +156,149 @@ static Fl_Value_Slider* param_adaptive_threshold_kernel;
 static Fl_Value_Slider* param_adaptive_threshold;
 static Fl_Value_Slider* param_morphologic_depth;
 
-static Fl_Output* leftAccum;
-static Fl_Output* rightAccum;
-static double     leftAccumValue  = 0.0;
-static double     rightAccumValue = 0.0;
+// The arenas. By default there are two circles, placed by clicking on the left and right (or top
+// and bottom) halves of the image. --arenas RxC splits the image into a grid instead, with one
+// circle per cell, and --arena-file reads fixed circles and polygons from a file
+static arena_t    arenas[MAX_ARENAS];
+static int        numArenas      = 2;
+static int        arenaGridRows  = 1;
+static int        arenaGridCols  = 2;
+static bool       arenasFromFile = false;
+static arenaMap_t arenaMap;
+static bool       processArenasOnly = true;
+static visionSmoothing_t smoothing   = VISION_SMOOTHING_GAUSSIAN;
+static visionPrecision_t precision   = VISION_PRECISION_FLOAT;
+static unsigned int      detrendRefreshFrames = 1;
+
+// With --downsample N, the vision runs on the frame shrunk N times in each direction, with the
+// parameters and arenas scaled to match. The recordings and the display stay at full resolution:
+// the mask is scaled back up to be shown or stored
+static int      downsample        = 1;
+static IplImage* downsampledFrame = NULL;
+static CvMat*    upsampledMask    = NULL;
+
+static Fl_Scroll* accumScroll;
+static Fl_Output* arenaAccums[MAX_ARENAS];
+static double     arenaAccumValues[MAX_ARENAS];
 
 // the analysis could be idle, running, or idle examining data (STOPPED)
 static enum { RESET, RUNNING, STOPPED } analysisState;
 
-static int           numPoints;
-static uint64_t      nextDataTimestamp_us;
-static Ca_LinePoint* lastLeftPoint       = NULL;
-static Ca_LinePoint* lastRightPoint      = NULL;
-static CvPoint       leftCircleCenter    = cvPoint(-1, -1);
-static CvPoint       rightCircleCenter   = cvPoint(-1, -1);
+static sampleScheduler_t sampleScheduler;
+static FILE*             samplesLog = NULL;
+
+// the samples being averaged into the next plot point
+static int    plotBinSize  = 1;
+static int    plotBinCount = 0;
+static double plotBinSums[MAX_ARENAS];
+static Ca_LinePoint* lastArenaPoints[MAX_ARENAS];
 static CvPoint       pointedCircleCenter = cvPoint(-1, -1);
 
 FILE* plotPipe = NULL;
 static string baseFilename;
 
-#define HAVE_LEFT_CIRCLE    (leftCircleCenter .x > 0 && leftCircleCenter .y > 0)
-#define HAVE_RIGHT_CIRCLE   (rightCircleCenter.x > 0 && rightCircleCenter.y > 0)
-#define HAVE_CIRCLES        (HAVE_LEFT_CIRCLE && HAVE_RIGHT_CIRCLE)
+// When recording only the arenas, each circle's bounding box (plus a margin) is copied into its own
+// tile of a small mosaic, and only the mosaic is encoded
+static bool      recordArenasOnly = false;
+static IplImage* arenaMosaic      = NULL;
+static CvRect    arenaTiles[MAX_ARENAS];
+
+static bool      recordFrameArchive = false;
+
+// the binary masks of each sample can be stored to recompute the occupancy of other circles later
+static bool                recordMasks = false;
+static maskArchiveWriter_t maskArchive = { NULL, 0, 0, NULL };
+
+// the frame statistics are dumped to stderr on exit and on SIGUSR1, and to the stats file
+// periodically
+static FILE*                 statsFile          = NULL;
+static int                   statsFilePeriod_s  = STATS_FILE_PERIOD_S;
+static volatile sig_atomic_t statsDumpRequested = 0;
+
+static const char* traceFilename  = NULL;
+static uint32_t    traceNumEvents = FRAME_TRACE_DEFAULT_EVENTS;
+
+// the display widgets, instrumented to show their redraws in the timeline trace
+class TracedCvFltkWidget : public CvFltkWidget
+{
+public:
+    TracedCvFltkWidget(int x, int y, int w, int h, CvFltkWidget_ColorChoice colorMode)
+        : CvFltkWidget(x, y, w, h, colorMode) { }
+
+    void draw()
+    {
+        FrameTraceScope trace("CvFltkWidget::draw");
+        CvFltkWidget::draw();
+    }
+};
+
+class TracedCanvas : public Ca_Canvas
+{
+public:
+    TracedCanvas(int x, int y, int w, int h, const char* label = 0)
+        : Ca_Canvas(x, y, w, h, label) { }
+
+    void draw()
+    {
+        FrameTraceScope trace("Ca_Canvas::draw");
+        Ca_Canvas::draw();
+    }
+};
+
+#define HAVE_ARENA(i)       (arenas[i].center.x > 0 && arenas[i].center.y > 0)
 #define HAVE_POINTED_CIRCLE (pointedCircleCenter.x > 0 && pointedCircleCenter.y > 0)
 
+static bool haveAllArenas(void)
+{
+    for(int i=0; i<numArenas; i++)
+        if(!HAVE_ARENA(i))
+            return false;
+    return true;
+}
+
+static void clearArenas(void)
+{
+    for(int i=0; i<numArenas; i++)
+    {
+        arenas[i].center      = cvPoint(-1, -1);
+        arenas[i].radius      = CIRCLE_RADIUS;
+        arenas[i].numVertices = 0;
+    }
+}
+
+static CvRect getArenaBounds(const arena_t* arena)
+{
+    if(arena->numVertices == 0)
+        return cvRect(arena->center.x - arena->radius, arena->center.y - arena->radius,
+                      2*arena->radius, 2*arena->radius);
+
+    int x0 = arena->vertices[0].x, x1 = x0;
+    int y0 = arena->vertices[0].y, y1 = y0;
+    for(int i=1; i<arena->numVertices; i++)
+    {
+        x0 = MIN(x0, arena->vertices[i].x);
+        x1 = MAX(x1, arena->vertices[i].x);
+        y0 = MIN(y0, arena->vertices[i].y);
+        y1 = MAX(y1, arena->vertices[i].y);
+    }
+    return cvRect(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+}
+
+// Line colors of the arenas in the plot. The first two match the original left/right colors
+static Fl_Color getArenaColor(int i)
+{
+    static const Fl_Color colors[] =
+        { FL_RED, FL_GREEN, FL_BLUE, FL_MAGENTA, FL_CYAN, FL_DARK_YELLOW,
+          FL_DARK_RED, FL_DARK_GREEN, FL_DARK_BLUE, FL_DARK_MAGENTA, FL_DARK_CYAN, FL_BLACK };
+    return colors[i % (sizeof(colors)/sizeof(colors[0]))];
+}
+
+static void buildArenaMap(void)
+{
+    arenaMapClear(&arenaMap);
+    arenaMapAddArenas(&arenaMap, arenas, numArenas, downsample);
+}
+
 static void setStoppedAnalysis(void);
 
 static void forceStopAnalysis(void)
@@ -120,6 +307,246 @@ static void forceStopAnalysis(void)
     setStoppedAnalysis();
 }
 
+static CvRect getArenaTile(CvPoint center, int tileW, int tileH)
+{
+    // every tile has the same size, so near the edges of the frame I shift the tile inwards instead
+    // of clipping it
+    tileW = MIN(tileW, source->w());
+    tileH = MIN(tileH, source->h());
+
+    int x = MIN(MAX(center.x - tileW/2, 0), source->w() - tileW);
+    int y = MIN(MAX(center.y - tileH/2, 0), source->h() - tileH);
+    return cvRect(x, y, tileW, tileH);
+}
+
+// the tiles are laid out in a roughly square grid, row-major
+static int getMosaicCols(void)
+{
+    int cols = 1;
+    while(cols*cols < numArenas)
+        cols++;
+    return cols;
+}
+
+static CvRect getMosaicTile(int i)
+{
+    int cols = getMosaicCols();
+    return cvRect((i % cols) * arenaTiles[0].width, (i / cols) * arenaTiles[0].height,
+                  arenaTiles[i].width, arenaTiles[i].height);
+}
+
+static IplImage* composeArenaMosaic(IplImage* frame)
+{
+    for(int i=0; i<numArenas; i++)
+    {
+        cvSetImageROI(frame,       arenaTiles[i]);
+        cvSetImageROI(arenaMosaic, getMosaicTile(i));
+        cvCopy(frame, arenaMosaic);
+    }
+
+    cvResetImageROI(frame);
+    cvResetImageROI(arenaMosaic);
+    return arenaMosaic;
+}
+
+// Sets up the mosaic for this run and writes its geometry next to the video, so that the mosaic can
+// be mapped back to the source frame when reanalyzing
+static bool setupArenaRecording(void)
+{
+    int tileW = 0, tileH = 0;
+    for(int i=0; i<numArenas; i++)
+    {
+        CvRect bounds = getArenaBounds(&arenas[i]);
+        tileW = MAX(tileW, bounds.width  + 2*ARENA_RECORDING_MARGIN);
+        tileH = MAX(tileH, bounds.height + 2*ARENA_RECORDING_MARGIN);
+    }
+    for(int i=0; i<numArenas; i++)
+        arenaTiles[i] = getArenaTile(arenas[i].center, tileW, tileH);
+
+    int cols = getMosaicCols();
+    int rows = (numArenas + cols - 1) / cols;
+    if(arenaMosaic != NULL)
+        cvReleaseImage(&arenaMosaic);
+    arenaMosaic = cvCreateImage(cvSize(cols * arenaTiles[0].width, rows * arenaTiles[0].height),
+                                IPL_DEPTH_8U, 1);
+    cvZero(arenaMosaic);
+
+    string geometryFilename = baseFilename + ".arenas";
+    FILE* geometry = fopen(geometryFilename.c_str(), "w");
+    if(geometry == NULL)
+        return false;
+
+    fprintf(geometry, "# arena-only recording of %dx%d frames into a %dx%d mosaic\n",
+            source->w(), source->h(), arenaMosaic->width, arenaMosaic->height);
+    fprintf(geometry, "# arena source_x source_y mosaic_x mosaic_y w h shape\n");
+    fprintf(geometry, "# the shape is 'circle X Y RADIUS' or 'polygon X0,Y0 X1,Y1 ...', in source coordinates\n");
+    for(int i=0; i<numArenas; i++)
+    {
+        CvRect mosaicTile = getMosaicTile(i);
+        fprintf(geometry, "%d %d %d %d %d %d %d",
+                i + 1, arenaTiles[i].x, arenaTiles[i].y, mosaicTile.x, mosaicTile.y,
+                arenaTiles[i].width, arenaTiles[i].height);
+
+        if(arenas[i].numVertices == 0)
+            fprintf(geometry, " circle %d %d %d\n", arenas[i].center.x, arenas[i].center.y, arenas[i].radius);
+        else
+        {
+            fprintf(geometry, " polygon");
+            for(int j=0; j<arenas[i].numVertices; j++)
+                fprintf(geometry, " %d,%d", arenas[i].vertices[j].x, arenas[i].vertices[j].y);
+            fprintf(geometry, "\n");
+        }
+    }
+    fclose(geometry);
+    return true;
+}
+
+static uint64_t lastFrameDone_ns = 0;
+static uint64_t lastTimestamp_us = 0;
+
+static void frameArrived(uint64_t timestamp_us)
+{
+    frameStatsCountFrame();
+
+    if(lastFrameDone_ns != 0)
+        frameStatsRecord(FRAME_STAGE_CAPTURE, frameStatsNow_ns() - lastFrameDone_ns);
+
+    // The camera is polled at cameraRate_fps. If I see a bigger gap than that, I couldn't keep up,
+    // and frames were dropped. Only a real camera runs at that rate: the synthetic source is paced
+    // at its own, and the stored sources aren't paced at all
+    if(dynamic_cast<CameraSource_IIDC*>(source) != NULL &&
+       lastTimestamp_us != 0 && timestamp_us > lastTimestamp_us)
+    {
+        uint64_t period_us = 1e6/cameraRate_fps;
+        uint64_t gap_us    = timestamp_us - lastTimestamp_us;
+        if(gap_us > period_us * 3/2)
+            frameStatsCountDropped((gap_us + period_us/2) / period_us - 1);
+    }
+    lastTimestamp_us = timestamp_us;
+}
+
+static void frameDone(void)
+{
+    lastFrameDone_ns = frameStatsNow_ns();
+}
+
+static void lockFromSourceThread(void)
+{
+    FrameStatsSpan span(FRAME_STAGE_LOCK_WAIT);
+    Fl::lock();
+}
+
+// called in the recording thread for each queued frame
+static void writeRecordedFrame(IplImage* frame, uint64_t timestamp_us)
+{
+    FrameStatsSpan span(FRAME_STAGE_WRITE);
+    if(videoEncoder)
+        videoEncoder.writeFrameGrayscale(recordArenasOnly ? composeArenaMosaic(frame) : frame);
+    if(frameArchive)
+        frameArchive.writeFrame(frame, timestamp_us);
+}
+
+static bool startRecordingThread(void)
+{
+    if(!videoEncoder && !frameArchive)
+        return true;
+
+    return frameWriter.start(source->w(), source->h(), RECORDING_QUEUE_LENGTH, &writeRecordedFrame);
+}
+
+// Picks the plot bin size so that a run of the full duration fits into MAX_PLOT_POINTS points
+static void resetPlotBins(void)
+{
+    double numSamples = duration->value() * 60.0 * dataRate_hz;
+    plotBinSize  = (int)ceil(numSamples / MAX_PLOT_POINTS);
+    if(plotBinSize < 1)
+        plotBinSize = 1;
+
+    plotBinCount = 0;
+    for(int i=0; i<numArenas; i++)
+        plotBinSums[i] = 0.0;
+}
+
+// Adds a sample to the current plot bin. Returns true if the bin is complete, and the mean
+// occupancy of each arena was written to means[]
+static bool addToPlotBin(const double occupancy[], double means[])
+{
+    for(int i=0; i<numArenas; i++)
+        plotBinSums[i] += occupancy[i];
+    if(++plotBinCount < plotBinSize)
+        return false;
+
+    for(int i=0; i<numArenas; i++)
+    {
+        means[i]       = plotBinSums[i] / plotBinCount;
+        plotBinSums[i] = 0.0;
+    }
+    plotBinCount = 0;
+    return true;
+}
+
+static void drawArenas(void)
+{
+    static CvFont font;
+    static bool   haveFont = false;
+    if(!haveFont)
+    {
+        cvInitFont(&font, CV_FONT_HERSHEY_PLAIN, 1.0, 1.0);
+        haveFont = true;
+    }
+
+    for(int i=0; i<numArenas; i++)
+    {
+        if(!HAVE_ARENA(i))
+            continue;
+
+        if(arenas[i].numVertices == 0)
+            cvCircle(*widgetImage, arenas[i].center, arenas[i].radius, CIRCLE_COLOR, 1, 8);
+        else
+        {
+            CvPoint* contour = arenas[i].vertices;
+            cvPolyLine(*widgetImage, &contour, &arenas[i].numVertices, 1, 1, CIRCLE_COLOR, 1, 8);
+        }
+
+        // with more than two arenas, I label them to match the accumulators
+        if(numArenas > 2)
+        {
+            char label[16];
+            snprintf(label, sizeof(label), "%d", i + 1);
+            cvPutText(*widgetImage, label, arenas[i].center, &font, CIRCLE_COLOR);
+        }
+    }
+}
+
+// The index of the next frame of a stored video, since it was last restarted. Until the analysis
+// runs, the video is restarted after every frame, so its first frame is shown over and over. With
+// this as the frame id, retuning a vision parameter then only reruns the stages from that one on
+static uint64_t nextFrameIndex = 0;
+
+// the source the frames were decoded from, past a frame cache
+static FrameSource* getDecodingSource(void)
+{
+    FrameCacheSource* cache = dynamic_cast<FrameCacheSource*>(source);
+    return cache != NULL ? cache->getCachedSource() : source;
+}
+
+static void restartSource(void)
+{
+    source->restartStream();
+    nextFrameIndex = 0;
+}
+
+static bool gotNewFrame(IplImage* buffer, uint64_t timestamp_us);
+
+static bool gotNewPooledFrame(PooledFrame* frame)
+{
+    currentPooledFrame = frame;
+    bool keepGoing = gotNewFrame(frame != NULL ? &frame->image : NULL,
+                                 frame != NULL ? frame->timestamp_us : 0);
+    currentPooledFrame = NULL;
+    return keepGoing;
+}
+
 static bool gotNewFrame(IplImage* buffer, uint64_t timestamp_us)
 {
     if(buffer == NULL)
@@ -128,7 +555,7 @@ static bool gotNewFrame(IplImage* buffer, uint64_t timestamp_us)
         {
             // error ocurred reading the stored video. I likely reached the end of the file. I stop
             // the analysis if I'm running it and rewind the stream
-            source->restartStream();
+            restartSource();
             if(analysisState == RUNNING)
                 forceStopAnalysis();
 
@@ -137,11 +564,18 @@ static bool gotNewFrame(IplImage* buffer, uint64_t timestamp_us)
         return false;
     }
 
-    cvMerge(buffer, buffer, buffer, NULL, *widgetImage);
+    frameArrived(timestamp_us);
+    FrameStatsSpan totalSpan(FRAME_STAGE_TOTAL);
+
+    {
+        FrameStatsSpan span(FRAME_STAGE_MERGE);
+        cvMerge(buffer, buffer, buffer, NULL, *widgetImage);
+    }
 
     visionParameters_t params;
+    getDefaultParameters(&params);
     bool doShowProcessedVision;
-    Fl::lock();
+    lockFromSourceThread();
     {
         params.presmoothing_w            = param_presmoothing_w           ->value();
         params.detrend_w                 = param_detrend_w                ->value();
@@ -152,69 +586,157 @@ static bool gotNewFrame(IplImage* buffer, uint64_t timestamp_us)
         doShowProcessedVision            = showProcessedVision            ->value();
     }
     Fl::unlock();
+    params.smoothing = smoothing;
+    params.precision = precision;
+    params.detrend_refresh_frames = detrendRefreshFrames;
     // these must be odd
     params.presmoothing_w            |= 1;
     params.detrend_w                 |= 1;
     params.adaptive_threshold_kernel |= 1;
+    scaleParameters(&params, downsample);
+
+    // a camera never repeats a frame, so there's nothing to reuse
+    uint64_t frameId = AM_READING_CAMERA ? VISION_FRAME_UNKNOWN : nextFrameIndex;
+    nextFrameIndex++;
 
-    const CvMat* result = isolateWorms(buffer, &params);
+    const CvMat* result;
+    {
+        FrameStatsSpan span(FRAME_STAGE_VISION);
+        // the recorder gets the full-resolution buffer either way
+        IplImage* input = buffer;
+        if(downsample > 1)
+        {
+            cvResize(buffer, downsampledFrame, CV_INTER_AREA);
+            input = downsampledFrame;
+        }
+
+        // While the analysis runs, only the arenas matter, so I process just them and the filter
+        // support around them. The whole frame is needed to display the processed image, and to
+        // record masks that can be reanalyzed with other arenas later
+        if(processArenasOnly && analysisState == RUNNING && !doShowProcessedVision && maskArchive.fp == NULL)
+            result = isolateWormsMemoized(input, frameId, &params, arenaMap.arenaBounds, arenaMap.numArenas, NULL);
+        else
+            result = isolateWormsMemoized(input, frameId, &params, NULL, 0, NULL);
+    }
+
+    // the occupancy comes from the packed mask, at the processing resolution. Only the images
+    // that are shown or stored need the full resolution
+    const CvMat* fullResult = result;
+    if(downsample > 1 && (doShowProcessedVision || maskArchive.fp))
+    {
+        cvResize(result, upsampledMask, CV_INTER_NN);
+        fullResult = upsampledMask;
+    }
     if(doShowProcessedVision)
     {
         cvSetImageCOI(*widgetImage, 1);
-        cvCopy(result, *widgetImage);
+        cvCopy(fullResult, *widgetImage);
         cvSetImageCOI(*widgetImage, 0);
     }
 
-    if(HAVE_LEFT_CIRCLE)
-        cvCircle(*widgetImage, leftCircleCenter,    CIRCLE_RADIUS, CIRCLE_COLOR, 1, 8);
-
-    if(HAVE_RIGHT_CIRCLE)
-        cvCircle(*widgetImage, rightCircleCenter,   CIRCLE_RADIUS, CIRCLE_COLOR, 1, 8);
+    drawArenas();
 
     if(HAVE_POINTED_CIRCLE)
         cvCircle(*widgetImage, pointedCircleCenter, CIRCLE_RADIUS, POINTED_CIRCLE_COLOR, 1, 8);
 
-    // This critical section is likely larger than it needs to be, but this keeps me safe. The
-    // analysis state can change in the FLTK thread, so I err on the side of safety
-    Fl::lock();
+    // The occupancy only depends on this frame and on the circles, which can't move while the
+    // analysis is running, and it's only needed for the frames that are sampled. I thus compute it
+    // before taking the lock, to keep the critical section short. The unlocked reads of the analysis
+    // state and of the scheduler are only a hint: they're checked again below, and the occupancy is
+    // computed there if the hint was wrong
+    double occupancy[MAX_ARENAS];
+    bool   haveOccupancy = false;
+    if( analysisState == RUNNING &&
+        (!AM_READING_CAMERA || sampleSchedulerIsDue(&sampleScheduler, timestamp_us)) )
+    {
+        FrameStatsSpan occupancySpan(FRAME_STAGE_OCCUPANCY);
+        computeArenaOccupancy(getIsolatedWormsPacked(), &arenaMap, occupancy);
+        haveOccupancy = true;
+    }
+
+    // The analysis state can change in the FLTK thread, so the bookkeeping happens with the lock
+    // held
+    lockFromSourceThread();
     {
+        if(!HAVE_REAL_TIMESTAMPS)
+            timestamp_us = sampleScheduler.numSamples * sampleScheduler.period_us;
+
         // when using the camera, I get frames much faster than I use them to keep the program
-        // looking visually responsive. Here I limit my data collection rate
-        if( analysisState == RUNNING && (!AM_READING_CAMERA || timestamp_us > nextDataTimestamp_us) )
+        // looking visually responsive. Here I limit my data collection rate. Stored frames are
+        // already at the data collection rate, so I sample each one
+        if( analysisState == RUNNING &&
+            (!AM_READING_CAMERA || sampleSchedulerIsDue(&sampleScheduler, timestamp_us)) )
         {
-            if(nextDataTimestamp_us == 0ull)
-                nextDataTimestamp_us = timestamp_us;
-            nextDataTimestamp_us += 1e6/DATA_FRAME_RATE_FPS;
-
-            if(videoEncoder) videoEncoder.writeFrameGrayscale(buffer);
-
-            double minutes = (double)numPoints / DATA_FRAME_RATE_FPS / 60.0;
-            double leftOccupancy, rightOccupancy;
-            computeWormOccupancy(result, &leftCircleCenter, &rightCircleCenter,
-                                 CIRCLE_RADIUS,
-                                 &leftOccupancy, &rightOccupancy);
-
-            Yaxis->rescale(CA_WHEN_MAX, fmax(leftOccupancy, rightOccupancy) );
-
-            lastLeftPoint  = new Ca_LinePoint(lastLeftPoint,
-                                              minutes,
-                                              leftOccupancy,  1,FL_RED,   CA_NO_POINT);
-            lastRightPoint = new Ca_LinePoint(lastRightPoint,
-                                              minutes,
-                                              rightOccupancy, 1,FL_GREEN, CA_NO_POINT);
-            if(plotPipe)
-                fprintf(plotPipe, "%f %f %f\n", minutes, leftOccupancy, rightOccupancy);
-
-            Xaxis->maximum(minutes);
-            numPoints++;
-
-            leftAccumValue  += leftOccupancy  / DATA_FRAME_RATE_FPS;
-            rightAccumValue += rightOccupancy / DATA_FRAME_RATE_FPS;
-            char results[128];
-            snprintf(results, sizeof(results), "%.3f", leftAccumValue);
-            leftAccum->value(results);
-            snprintf(results, sizeof(results), "%.3f", rightAccumValue);
-            rightAccum->value(results);
+            sample_t sample;
+            sampleSchedulerTake(&sampleScheduler, timestamp_us, &sample);
+
+            if(!haveOccupancy)
+            {
+                FrameStatsSpan occupancySpan(FRAME_STAGE_OCCUPANCY);
+                computeArenaOccupancy(getIsolatedWormsPacked(), &arenaMap, occupancy);
+            }
+
+            frameStatsRecord(FRAME_STAGE_SAMPLE_JITTER, llabs(sample.jitter_us) * 1000ull);
+            if(sample.missed)
+                frameStatsCountMissedSamples(sample.missed);
+
+            FrameStatsSpan encodeSpan(FRAME_STAGE_ENCODE);
+            if(frameWriter.isRunning())
+            {
+                if(currentPooledFrame != NULL)
+                    frameWriter.pushPooled(currentPooledFrame);
+                else
+                    frameWriter.push(buffer, timestamp_us);
+            }
+            if(maskArchive.fp)
+                maskArchiveWriteMask(&maskArchive, fullResult->data.ptr, fullResult->step,
+                                     sample.elapsed_us, sample.duration_us);
+            encodeSpan.end();
+
+            FrameStatsSpan plotSpan(FRAME_STAGE_PLOT);
+            double minutes = (double)sample.elapsed_us / 60e6;
+            double plotted[MAX_ARENAS];
+            if(addToPlotBin(occupancy, plotted))
+            {
+                double maxPlotted = 0.0;
+                for(int i=0; i<numArenas; i++)
+                {
+                    maxPlotted = fmax(maxPlotted, plotted[i]);
+                    lastArenaPoints[i] = new Ca_LinePoint(lastArenaPoints[i],
+                                                          minutes,
+                                                          plotted[i], 1, getArenaColor(i), CA_NO_POINT);
+                }
+                Yaxis->rescale(CA_WHEN_MAX, maxPlotted);
+
+                if(plotPipe)
+                {
+                    fprintf(plotPipe, "%f", minutes);
+                    for(int i=0; i<numArenas; i++)
+                        fprintf(plotPipe, " %f", plotted[i]);
+                    fprintf(plotPipe, "\n");
+                }
+                Xaxis->maximum(minutes);
+            }
+            if(samplesLog)
+            {
+                fprintf(samplesLog, "%f %f %.3f %llu",
+                        minutes, sample.duration_us / 1e6, sample.jitter_us / 1e3,
+                        (unsigned long long)sample.missed);
+                for(int i=0; i<numArenas; i++)
+                    fprintf(samplesLog, " %f", occupancy[i]);
+                fprintf(samplesLog, "\n");
+            }
+
+            // the occupancy is integrated over the time that actually elapsed
+            for(int i=0; i<numArenas; i++)
+            {
+                arenaAccumValues[i] += occupancy[i] * sample.duration_us / 1e6;
+
+                char results[128];
+                snprintf(results, sizeof(results), "%.3f", arenaAccumValues[i]);
+                arenaAccums[i]->value(results);
+            }
+            plotSpan.end();
 
             if(minutes > duration->value())
                 forceStopAnalysis();
@@ -223,13 +745,18 @@ static bool gotNewFrame(IplImage* buffer, uint64_t timestamp_us)
         widgetImage->redrawNewFrame();
     }
 
+    totalSpan.end();
+
     if(!AM_READING_CAMERA && analysisState != RUNNING)
     {
         Fl::unlock();
 
         // reading from a video file and not actually running the analysis yet. In this case I
-        // rewind back to the beginning and delay, to force a reasonable refresh rate
-        source->restartStream();
+        // rewind back to the beginning and delay, to force a reasonable refresh rate. A frame
+        // cache is instead played through, and rewound when it runs out, so the parameters are
+        // tuned on the whole cached window
+        if(!AM_PLAYING_FRAME_CACHE)
+            restartSource();
 
         struct timespec tv;
         tv.tv_sec  = 0;
@@ -239,12 +766,13 @@ static bool gotNewFrame(IplImage* buffer, uint64_t timestamp_us)
     else
         Fl::unlock();
 
+    frameDone();
     return true;
 }
 
 static void goResetButton_handleActivation(void)
 {
-    if( !experimentName->value() || experimentName->value()[0] == '\0' || !HAVE_CIRCLES)
+    if( !experimentName->value() || experimentName->value()[0] == '\0' || !haveAllArenas())
         goResetButton->deactivate();
     else
         goResetButton->activate();
@@ -259,15 +787,20 @@ static void widgetImageCallback(Fl_Widget* widget __attribute__((unused)), void*
         return;
     }
 
-    if(analysisState == RUNNING)
+    // the arenas read from a file can't be moved
+    if(analysisState == RUNNING || arenasFromFile)
     {
         pointedCircleCenter.x = pointedCircleCenter.y = -1;
         return;
     }
 
-    bool onLeftHalf = orientationLeftRight->value() ?
-        ( (Fl::event_x() - widget->x()) < FRAME_W/2 ) :
-        ( (Fl::event_y() - widget->y()) < FRAME_H/2 );
+    // The image is split into a grid of cells, one per arena. The orientation selector transposes
+    // the grid: by default (1x2) this picks between left/right and top/bottom halves
+    int rows = orientationLeftRight->value() ? arenaGridRows : arenaGridCols;
+    int cols = orientationLeftRight->value() ? arenaGridCols : arenaGridRows;
+    int row  = MIN(MAX((Fl::event_y() - widget->y()) * rows / widget->h(), 0), rows - 1);
+    int col  = MIN(MAX((Fl::event_x() - widget->x()) * cols / widget->w(), 0), cols - 1);
+    arena_t* pointedArena = &arenas[row*cols + col];
 
     switch(Fl::event())
     {
@@ -281,16 +814,8 @@ static void widgetImageCallback(Fl_Widget* widget __attribute__((unused)), void*
         break;
 
     case FL_PUSH:
-        if(onLeftHalf)
-        {
-            leftCircleCenter.x = Fl::event_x() - widget->x();
-            leftCircleCenter.y = Fl::event_y() - widget->y();
-        }
-        else
-        {
-            rightCircleCenter.x = Fl::event_x() - widget->x();
-            rightCircleCenter.y = Fl::event_y() - widget->y();
-        }
+        pointedArena->center.x = Fl::event_x() - widget->x();
+        pointedArena->center.y = Fl::event_y() - widget->y();
 
         pointedCircleCenter.x = pointedCircleCenter.y = -1;
         break;
@@ -322,10 +847,14 @@ static void openPlotPipe(void)
     // doesn't store its data in plain ASCII
 
     string command("feedGnuplot.pl --lines --domain "
-                   "--xlabel Minutes --ylabel \"Occupancy ratio\" "
-                   "--le \"Left circle occupancy total 888.88888 ratio-seconds\" "
-                   "--le \"Right circle occupancy total 888.88888 ratio-seconds\" "
-                   "--title \"Worm occupancy for ");
+                   "--xlabel Minutes --ylabel \"Occupancy ratio\" ");
+    for(int i=0; i<numArenas; i++)
+    {
+        char legend[128];
+        snprintf(legend, sizeof(legend), "--le \"Arena %d occupancy total 888.88888 ratio-seconds\" ", i + 1);
+        command += legend;
+    }
+    command += "--title \"Worm occupancy for ";
     command += experimentName->value();
     command += "\" --hardcopy \"";
     command += baseFilename;
@@ -338,22 +867,17 @@ static void openPlotPipe(void)
 
 static void finalizePlot(void)
 {
-    string leftLegend("Left circle occupancy (total ");
-    leftLegend += leftAccum->value();
-    leftLegend += " ratio-seconds)";
-
-    string rightLegend("Right circle occupancy (total ");
-    rightLegend += rightAccum->value();
-    rightLegend += " ratio-seconds)";
-
-    string command;
-
-    command = "perl -p -i -e 's/Left circle occupancy total 888.88888 ratio-seconds/";
-    command += leftLegend + "/' \"" + baseFilename + ".ps\"";
-    system(command.c_str());
-
-    command = "perl -p -i -e 's/Right circle occupancy total 888.88888 ratio-seconds/";
-    command += rightLegend + "/' \"" + baseFilename + ".ps\"";
+    // all the legends are fixed up in one pass over the file
+    string command = "perl -p -i -e '";
+    for(int i=0; i<numArenas; i++)
+    {
+        char substitution[256];
+        snprintf(substitution, sizeof(substitution),
+                 "s/Arena %d occupancy total 888.88888 ratio-seconds/Arena %d occupancy (total %s ratio-seconds)/;",
+                 i + 1, i + 1, arenaAccums[i]->value());
+        command += substitution;
+    }
+    command += "' \"" + baseFilename + ".ps\"";
     system(command.c_str());
 
     command = "ps2pdf \"";
@@ -376,7 +900,7 @@ static void deactivateExperimentWidgets(void)
     experimentName                 ->deactivate();
     duration                       ->deactivate();
     chdirButton                    ->deactivate();
-    orientationLeftRight           ->deactivate();
+    circleOrientation              ->deactivate();
 }
 
 static void activateExperimentWidgets(void)
@@ -390,7 +914,8 @@ static void activateExperimentWidgets(void)
     experimentName                 ->activate();
     duration                       ->activate();
     chdirButton                    ->activate();
-    orientationLeftRight           ->activate();
+    if(!arenasFromFile)
+        circleOrientation          ->activate();
 }
 
 static void setResetAnalysis(void)
@@ -401,16 +926,17 @@ static void setResetAnalysis(void)
     goResetButton->label("Analyze");
     activateExperimentWidgets();
 
-    numPoints       = 0;
+    sampleSchedulerReset(&sampleScheduler, 1e6/dataRate_hz);
     if(plot) plot->clear();
-    lastLeftPoint   = lastRightPoint = NULL; 
-    leftAccumValue  = 0.0;
-    rightAccumValue = 0.0;
-    leftAccum ->value("0.0");
-    rightAccum->value("0.0");
+    for(int i=0; i<numArenas; i++)
+    {
+        lastArenaPoints[i]  = NULL;
+        arenaAccumValues[i] = 0.0;
+        arenaAccums[i]->value("0.0");
+    }
 
     if(!AM_READING_CAMERA)
-        source->restartStream();
+        restartSource();
 
     analysisState = RESET;
 }
@@ -419,18 +945,55 @@ static void setRunningAnalysis(void)
 {
     createBaseOutputFilename();
 
-    if(AM_READING_CAMERA)
+    if(AM_READING_CAMERA && recordFrameArchive)
+    {
+        string archiveFilename = baseFilename + FRAME_ARCHIVE_EXTENSION;
+        if(!frameArchive.open(archiveFilename.c_str(), source->w(), source->h()))
+            fl_alert("Couldn't start frame recording. Frames will NOT be written");
+    }
+    else if(AM_READING_CAMERA)
     {
         string videoFilename = baseFilename + ".avi";
         videoEncoder.close();
-        videoEncoder.open(videoFilename.c_str(), source->w(), source->h(), VIDEO_ENCODING_FPS, FRAMESOURCE_GRAYSCALE);
+
+        // at high sample rates the video plays back in real time; otherwise it's a time-lapse
+        int encodingFps = (int)fmax(VIDEO_ENCODING_FPS, ceil(dataRate_hz));
+        if(!recordArenasOnly)
+            videoEncoder.open(videoFilename.c_str(), source->w(), source->h(), encodingFps, FRAMESOURCE_GRAYSCALE);
+        else if(setupArenaRecording())
+            videoEncoder.open(videoFilename.c_str(), arenaMosaic->width, arenaMosaic->height, encodingFps, FRAMESOURCE_GRAYSCALE);
 
         if(!videoEncoder)
             fl_alert("Couldn't start video recording. Video will NOT be written");
     }
 
+    if(!startRecordingThread())
+    {
+        fl_alert("Couldn't start the recording thread. Frames will NOT be written");
+        videoEncoder.close();
+        frameArchive.close();
+    }
+
     openPlotPipe();
 
+    // the timing of every sample, to check the quality of the data after the fact
+    string samplesFilename = baseFilename + ".samples";
+    samplesLog = fopen(samplesFilename.c_str(), "w");
+    if(samplesLog)
+    {
+        fprintf(samplesLog, "# minutes duration_s jitter_ms missed_deadlines");
+        for(int i=0; i<numArenas; i++)
+            fprintf(samplesLog, " occupancy_%d", i + 1);
+        fprintf(samplesLog, "\n");
+    }
+
+    if(recordMasks)
+    {
+        string masksFilename = baseFilename + MASK_ARCHIVE_EXTENSION;
+        if(!maskArchiveWriterOpen(&maskArchive, masksFilename.c_str(), source->w(), source->h()))
+            fl_alert("Couldn't open the mask archive. Masks will NOT be written");
+    }
+
     goResetButton->labelfont(FL_HELVETICA);
     goResetButton->labelcolor(FL_BLACK);
     goResetButton->type(FL_TOGGLE_BUTTON);
@@ -442,13 +1005,24 @@ static void setRunningAnalysis(void)
 
     pointedCircleCenter.x = pointedCircleCenter.y = -1;
 
-    nextDataTimestamp_us = 0ull;
+    sampleSchedulerReset(&sampleScheduler, 1e6/dataRate_hz);
+    resetPlotBins();
+    buildArenaMap();
     analysisState = RUNNING;
 }
 
 static void setStoppedAnalysis(void)
 {
+    // the queued frames are written out before the files are closed
+    frameWriter.stop();
     videoEncoder.close();
+    frameArchive.close();
+    maskArchiveWriterClose(&maskArchive);
+    if(samplesLog)
+    {
+        fclose(samplesLog);
+        samplesLog = NULL;
+    }
     if(plotPipe)
     {
         pclose(plotPipe);
@@ -514,28 +1088,120 @@ static void changedExperimentName(Fl_Widget* widget __attribute__((unused)), voi
 static void changedOrientation(Fl_Widget* widget __attribute__((unused)), void* cookie __attribute__((unused)))
 {
     // I touched the orientation selector, so kill my circles
-    leftCircleCenter    = cvPoint(-1, -1);
-    rightCircleCenter   = cvPoint(-1, -1);
+    clearArenas();
+}
+
+// The performance display. This is updated from a timer in the FLTK thread, reading the statistics
+// that the frame thread collects anyway, so it adds no work to the frame thread
+static void updatePerformanceHud(void* cookie __attribute__((unused)))
+{
+    static uint64_t lastTime_ns = 0, lastNumFrames = 0, lastNumDropped = 0;
+
+    uint64_t now_ns     = frameStatsNow_ns();
+    uint64_t numFrames  = frameStatsGetNumFrames();
+    uint64_t numDropped = frameStatsGetNumDropped();
+
+    double dt = (now_ns - lastTime_ns) / 1e9;
+    double processingFps = (lastTime_ns == 0) ? 0.0 : (numFrames - lastNumFrames) / dt;
+    double cameraFps     = (lastTime_ns == 0) ? 0.0 : (numFrames + numDropped - lastNumFrames - lastNumDropped) / dt;
+
+    lastTime_ns    = now_ns;
+    lastNumFrames  = numFrames;
+    lastNumDropped = numDropped;
+
+    char text[1024];
+    int  len = snprintf(text, sizeof(text),
+                        "camera:     %6.1f fps\n"
+                        "processing: %6.1f fps\n"
+                        "dropped:    %6llu frames\n"
+                        "missed:     %6llu samples\n"
+                        "recording:  %3d/%-3d queued, %llu dropped\n"
+                        "latency, p50/p99 ms:\n",
+                        cameraFps, processingFps, (unsigned long long)numDropped,
+                        (unsigned long long)frameStatsGetNumMissedSamples(),
+                        frameWriter.getQueueDepth(), frameWriter.getCapacity(),
+                        (unsigned long long)frameWriter.getNumDropped());
+
+    static const frameStage_t stages[] =
+        { FRAME_STAGE_MERGE, FRAME_STAGE_VISION, FRAME_STAGE_OCCUPANCY, FRAME_STAGE_ENCODE,
+          FRAME_STAGE_WRITE, FRAME_STAGE_PLOT, FRAME_STAGE_LOCK_WAIT, FRAME_STAGE_TOTAL, FRAME_STAGE_SAMPLE_JITTER };
+    for(unsigned int i=0; i<sizeof(stages)/sizeof(stages[0]) && len < (int)sizeof(text); i++)
+    {
+        frameStageSummary_t summary;
+        frameStatsSummarize(stages[i], &summary);
+        len += snprintf(&text[len], sizeof(text) - len, "  %-13s %7.2f %7.2f\n",
+                        frameStatsGetStageName(stages[i]),
+                        summary.p50_ns / 1e6, summary.p99_ns / 1e6);
+    }
+
+    performanceHud->value(text);
+    Fl::repeat_timeout(HUD_UPDATE_PERIOD_S, updatePerformanceHud);
+}
+
+static void toggledPerformanceHud(Fl_Widget* widget __attribute__((unused)), void* cookie __attribute__((unused)))
+{
+    if(showPerformance->value())
+    {
+        performanceHud->show();
+        Fl::add_timeout(HUD_UPDATE_PERIOD_S, updatePerformanceHud);
+    }
+    else
+    {
+        Fl::remove_timeout(updatePerformanceHud);
+        performanceHud->hide();
+    }
+}
+
+static void setupPerformanceHud(void)
+{
+    showPerformance = new Fl_Check_Button(showProcessedVision->x() + showProcessedVision->w(), showProcessedVision->y(),
+                                          ACCUM_W, ACCUM_H, "Display performance");
+    showPerformance->callback(toggledPerformanceHud);
+    showPerformance->value(0);
+
+    performanceHud = new Fl_Multiline_Output(WINDOW_W - HUD_W, HUD_Y, HUD_W, HUD_H);
+    performanceHud->textfont(FL_COURIER);
+    performanceHud->textsize(HUD_FONT_SIZE);
+    performanceHud->hide();
+}
+
+// One accumulator per arena, in a scrolled group so that any number of them fit in the space the
+// original two took
+static void setupArenaAccumulators(int x, int y)
+{
+    accumScroll = new Fl_Scroll(x, y, ACCUM_SCROLL_W, ACCUM_SCROLL_H);
+    accumScroll->type(Fl_Scroll::VERTICAL);
+    for(int i=0; i<numArenas; i++)
+    {
+        char label[64];
+        snprintf(label, sizeof(label), "Arena %d accumulator (ratio-seconds)", i + 1);
+
+        arenaAccums[i] = new Fl_Output(x, y + i*ACCUM_H, ACCUM_W, ACCUM_H);
+        arenaAccums[i]->copy_label(label);
+        arenaAccums[i]->align(FL_ALIGN_RIGHT);
+        arenaAccums[i]->labelcolor(getArenaColor(i));
+    }
+    accumScroll->end();
 }
 
 static void setupVisionParameters(void)
 {
-    param_presmoothing_w            = new Fl_Value_Slider(rightAccum->x(), rightAccum->y() + rightAccum->h(),
+    param_presmoothing_w            = new Fl_Value_Slider(accumScroll->x(), accumScroll->y() + accumScroll->h(),
                                                           PARAM_SLIDER_W, PARAM_SLIDER_H,
                                                           "Preesmoothing width");
-    param_detrend_w                 = new Fl_Value_Slider(rightAccum->x(), param_presmoothing_w->y() + param_presmoothing_w->h(),
+    param_detrend_w                 = new Fl_Value_Slider(accumScroll->x(), param_presmoothing_w->y() + param_presmoothing_w->h(),
                                                           PARAM_SLIDER_W, PARAM_SLIDER_H,
                                                           "Detrend width");
-    param_detrend_scale             = new Fl_Value_Slider(rightAccum->x(), param_detrend_w->y() + param_detrend_w->h(),
+    param_detrend_scale             = new Fl_Value_Slider(accumScroll->x(), param_detrend_w->y() + param_detrend_w->h(),
                                                           PARAM_SLIDER_W, PARAM_SLIDER_H,
                                                           "Detrend scaling");
-    param_adaptive_threshold_kernel = new Fl_Value_Slider(rightAccum->x(), param_detrend_scale->y() + param_detrend_scale->h(),
+    param_adaptive_threshold_kernel = new Fl_Value_Slider(accumScroll->x(), param_detrend_scale->y() + param_detrend_scale->h(),
                                                           PARAM_SLIDER_W, PARAM_SLIDER_H,
                                                           "Adaptive threshold kernel");
-    param_adaptive_threshold        = new Fl_Value_Slider(rightAccum->x(), param_adaptive_threshold_kernel->y() + param_adaptive_threshold_kernel->h(),
+    param_adaptive_threshold        = new Fl_Value_Slider(accumScroll->x(), param_adaptive_threshold_kernel->y() + param_adaptive_threshold_kernel->h(),
                                                           PARAM_SLIDER_W, PARAM_SLIDER_H,
                                                           "Adaptive threshold");
-    param_morphologic_depth         = new Fl_Value_Slider(rightAccum->x(), param_adaptive_threshold->y() + param_adaptive_threshold->h(),
+    param_morphologic_depth         = new Fl_Value_Slider(accumScroll->x(), param_adaptive_threshold->y() + param_adaptive_threshold->h(),
                                                           PARAM_SLIDER_W, PARAM_SLIDER_H,
                                                           "Morphologic depth");
     param_presmoothing_w           ->align(FL_ALIGN_RIGHT);
@@ -576,15 +1242,319 @@ static void setupVisionParameters(void)
     param_morphologic_depth        ->precision(0); // integers
 }
 
+static void requestStatsDump(int sig __attribute__((unused)))
+{
+    statsDumpRequested = 1;
+}
+
+static void pollStats(void* cookie __attribute__((unused)))
+{
+    static time_t nextStatsFileWrite = 0;
+
+    if(statsDumpRequested)
+    {
+        statsDumpRequested = 0;
+        frameStatsDump(stderr);
+    }
+
+    time_t now = time(NULL);
+    if(statsFile != NULL && now >= nextStatsFileWrite)
+    {
+        fprintf(statsFile, "# %s", ctime(&now));
+        frameStatsDump(statsFile);
+        nextStatsFileWrite = now + statsFilePeriod_s;
+    }
+
+    Fl::repeat_timeout(STATS_POLL_PERIOD_S, pollStats);
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s [options] [videofile | framearchive%s | 0xCAMERAGUID |\n"
+            "                     synthetic[:size=WxH,fps=N,worms=N,seed=N]]\n"
+            "\n"
+            "  The synthetic source renders reproducible fake frames in place of a camera. With\n"
+            "  fps=0 it renders them as fast as they are consumed\n"
+            "\n"
+            "  --record-arenas   record only the area around each circle, not the whole frame\n"
+            "  --record-frames   record an uncompressed, randomly-accessible %s archive instead\n"
+            "                    of an .avi\n"
+            "  --record-masks    store the binary mask of every sample in a %s archive, to be\n"
+            "                    reprocessed with maskOccupancy\n"
+            "  --stats-file FILE  periodically append the frame latency statistics to FILE. These\n"
+            "                    are also written to stderr on exit and on SIGUSR1\n"
+            "  --stats-period S  write to the stats file every S seconds. Default: %d\n"
+            "  --trace FILE      record a timeline of the frame processing, and write it to FILE\n"
+            "                    as Chrome Trace Event JSON on exit\n"
+            "  --trace-events N  keep the last N trace events. Default: %d\n"
+            "  --sample-rate HZ  collect occupancy samples at this rate. Default: %d. When\n"
+            "                    reanalyzing an .avi, pass the rate it was recorded at\n"
+            "  --camera-rate FPS poll the camera at this rate. Must be at least the sample\n"
+            "                    rate. Default: %d. The frames are processed one at a time,\n"
+            "                    in the frame thread, so a rate higher than the processing\n"
+            "                    sustains only drops frames (counted in the stats). On one\n"
+            "                    2.1GHz Xeon core, the whole-frame fixed16 processing takes\n"
+            "                    2.8ms a frame, about 350fps; float is slower\n"
+            "  --arenas RxC      track R*C circular arenas, placed by clicking in the cells of\n"
+            "                    an RxC grid over the image. Default: 1x2\n"
+            "  --arena-file FILE read fixed arenas from FILE, one per line, as\n"
+            "                    'circle X Y RADIUS' or 'polygon X0,Y0 X1,Y1 X2,Y2 ...'.\n"
+            "                    At most %d arenas are supported\n"
+            "  --full-frame      always process the whole frame. By default, while the analysis\n"
+            "                    runs without displaying the processed image or recording\n"
+            "                    masks, only the arenas are processed\n"
+            "  --smoothing KIND  how the presmoothing and detrending blurs are computed:\n"
+            "                    'gaussian' convolves with the kernel, at a cost that grows with\n"
+            "                    its width. 'recursive' uses a recursive approximation whose\n"
+            "                    cost doesn't. Away from the frame edges it's within 1.2%% of\n"
+            "                    full scale for widths of 7 and up, and 0.5%% for 11 and up;\n"
+            "                    near the edges it can be off by 15%%. Default: gaussian\n"
+            "  --precision KIND  the number format of the image processing: 'float', or\n"
+            "                    'fixed16', 16-bit fixed point, which is faster, and agrees with\n"
+            "                    float on all but a few hundredths of a percent of the mask.\n"
+            "                    fixed16 always uses the gaussian smoothing. Default: float\n"
+            "  --detrend-refresh N  reuse the detrending background for N frames before\n"
+            "                    recomputing it. It's recomputed sooner if the lighting changes.\n"
+            "                    Default: 1, every frame\n"
+            "  --downsample N    process the frames shrunk N times in each direction (N is 1, 2\n"
+            "                    or 4), with the kernel widths and the arenas scaled to match.\n"
+            "                    Roughly N*N times less vision work, for an occupancy that's\n"
+            "                    close to the full-resolution one; wormOffline measures how\n"
+            "                    close. The recordings and the display stay at full\n"
+            "                    resolution. Default: 1\n"
+            "  --cache-frames FIRST:COUNT  decode frames FIRST .. FIRST+COUNT-1 of a stored\n"
+            "                    video once, and play them back from memory, in a loop until\n"
+            "                    the analysis starts. For tuning the parameters without\n"
+            "                    decoding the video over and over. COUNT 0 caches as many\n"
+            "                    frames as fit. A running analysis only sees the cached\n"
+            "                    frames, and stops at the end of them\n"
+            "  --cache-memory MB the most memory the frame cache may use. Default: %d\n",
+            argv0, FRAME_ARCHIVE_EXTENSION, FRAME_ARCHIVE_EXTENSION, MASK_ARCHIVE_EXTENSION,
+            STATS_FILE_PERIOD_S, FRAME_TRACE_DEFAULT_EVENTS,
+            DATA_FRAME_RATE_FPS, CAMERA_FRAME_RATE_FPS, MAX_ARENAS, DEFAULT_CACHE_MEMORY_MB);
+}
+
+static bool parseCmdline(int argc, char* argv[])
+{
+    static const struct option options[] =
+        {
+            { "record-arenas", no_argument, NULL, 'a' },
+            { "record-frames", no_argument, NULL, 'f' },
+            { "record-masks",  no_argument, NULL, 'm' },
+            { "stats-file",    required_argument, NULL, 's' },
+            { "stats-period",  required_argument, NULL, 'S' },
+            { "trace",         required_argument, NULL, 't' },
+            { "trace-events",  required_argument, NULL, 'T' },
+            { "sample-rate",   required_argument, NULL, 'r' },
+            { "camera-rate",   required_argument, NULL, 'c' },
+            { "arenas",        required_argument, NULL, 'A' },
+            { "arena-file",    required_argument, NULL, 'F' },
+            { "full-frame",    no_argument, NULL, 'w' },
+            { "smoothing",     required_argument, NULL, 'g' },
+            { "precision",     required_argument, NULL, 'p' },
+            { "detrend-refresh", required_argument, NULL, 'd' },
+            { "downsample",    required_argument, NULL, 'D' },
+            { "cache-frames",  required_argument, NULL, 'C' },
+            { "cache-memory",  required_argument, NULL, 'M' },
+            { "help",          no_argument, NULL, 'h' },
+            { NULL, 0, NULL, 0 }
+        };
+
+    bool haveArenaGrid = false;
+    int  opt;
+    while((opt = getopt_long(argc, argv, "h", options, NULL)) != -1)
+    {
+        switch(opt)
+        {
+        case 'a':
+            recordArenasOnly = true;
+            break;
+
+        case 'f':
+            recordFrameArchive = true;
+            break;
+
+        case 'm':
+            recordMasks = true;
+            break;
+
+        case 's':
+            statsFile = fopen(optarg, "a");
+            if(statsFile == NULL)
+            {
+                fprintf(stderr, "couldn't open stats file '%s'\n", optarg);
+                return false;
+            }
+            break;
+
+        case 'S':
+            statsFilePeriod_s = atoi(optarg);
+            if(statsFilePeriod_s <= 0)
+            {
+                fprintf(stderr, "--stats-period must be a positive number of seconds\n");
+                return false;
+            }
+            break;
+
+        case 't':
+            traceFilename = optarg;
+            break;
+
+        case 'T':
+            if(atoi(optarg) <= 0)
+            {
+                fprintf(stderr, "--trace-events must be positive\n");
+                return false;
+            }
+            traceNumEvents = atoi(optarg);
+            break;
+
+        case 'r':
+            dataRate_hz = atof(optarg);
+            if(dataRate_hz <= 0.0)
+            {
+                fprintf(stderr, "--sample-rate must be positive\n");
+                return false;
+            }
+            break;
+
+        case 'c':
+            cameraRate_fps = atof(optarg);
+            if(cameraRate_fps <= 0.0)
+            {
+                fprintf(stderr, "--camera-rate must be positive\n");
+                return false;
+            }
+            break;
+
+        case 'A':
+            if(arenasFromFile)
+            {
+                fprintf(stderr, "--arenas and --arena-file are mutually exclusive\n");
+                return false;
+            }
+            if(sscanf(optarg, "%dx%d", &arenaGridRows, &arenaGridCols) != 2 ||
+               arenaGridRows <= 0 || arenaGridCols <= 0 ||
+               arenaGridRows * arenaGridCols > MAX_ARENAS)
+            {
+                fprintf(stderr, "--arenas takes ROWSxCOLS, with at most %d arenas\n", MAX_ARENAS);
+                return false;
+            }
+            numArenas = arenaGridRows * arenaGridCols;
+            haveArenaGrid = true;
+            break;
+
+        case 'F':
+            if(haveArenaGrid)
+            {
+                fprintf(stderr, "--arenas and --arena-file are mutually exclusive\n");
+                return false;
+            }
+            if(!readArenaFile(optarg, arenas, &numArenas))
+                return false;
+            arenasFromFile = true;
+            break;
+
+        case 'w':
+            processArenasOnly = false;
+            break;
+
+        case 'g':
+            if     (strcmp(optarg, "gaussian")  == 0) smoothing = VISION_SMOOTHING_GAUSSIAN;
+            else if(strcmp(optarg, "recursive") == 0) smoothing = VISION_SMOOTHING_RECURSIVE;
+            else
+            {
+                fprintf(stderr, "--smoothing must be 'gaussian' or 'recursive'\n");
+                return false;
+            }
+            break;
+
+        case 'p':
+            if     (strcmp(optarg, "float")   == 0) precision = VISION_PRECISION_FLOAT;
+            else if(strcmp(optarg, "fixed16") == 0) precision = VISION_PRECISION_FIXED16;
+            else
+            {
+                fprintf(stderr, "--precision must be 'float' or 'fixed16'\n");
+                return false;
+            }
+            break;
+
+        case 'd':
+            if(atoi(optarg) <= 0)
+            {
+                fprintf(stderr, "--detrend-refresh must be a positive number of frames\n");
+                return false;
+            }
+            detrendRefreshFrames = atoi(optarg);
+            break;
+
+        case 'D':
+            downsample = atoi(optarg);
+            if(downsample != 1 && downsample != 2 && downsample != 4)
+            {
+                fprintf(stderr, "--downsample must be 1, 2 or 4\n");
+                return false;
+            }
+            break;
+
+        case 'C':
+            if(sscanf(optarg, "%d:%d", &cacheFirstFrame, &cacheNumFrames) != 2 ||
+               cacheFirstFrame < 0 || cacheNumFrames < 0)
+            {
+                fprintf(stderr, "--cache-frames takes FIRST:COUNT, with COUNT 0 for as many as fit\n");
+                return false;
+            }
+            cacheFrames = true;
+            break;
+
+        case 'M':
+            if(atoi(optarg) <= 0)
+            {
+                fprintf(stderr, "--cache-memory must be a positive number of MB\n");
+                return false;
+            }
+            cacheMaxBytes = (size_t)atoi(optarg) << 20;
+            break;
+
+        default:
+            usage(argv[0]);
+            return false;
+        }
+    }
+
+    if(recordArenasOnly && recordFrameArchive)
+    {
+        fprintf(stderr, "--record-arenas only applies to .avi recordings\n");
+        return false;
+    }
+
+    if(!arenasFromFile)
+        clearArenas();
+
+    if(dataRate_hz > cameraRate_fps)
+    {
+        fprintf(stderr, "the sample rate (%g Hz) can't be higher than the camera rate (%g fps)\n",
+                dataRate_hz, cameraRate_fps);
+        return false;
+    }
+
+    return true;
+}
+
 int main(int argc, char* argv[])
 {
+    if(!parseCmdline(argc, argv))
+        return 1;
+
     Fl::lock();
     Fl::visual(FL_RGB);
 
-    // To load a video file, the last cmdline argument must be the file.
+    // To load a video file or a frame archive, the last cmdline argument must be the file.
     // To read a camera, the last cmdline argument must be 0x..., we use it as the camera GUID
+    // To render synthetic frames, the last cmdline argument must be synthetic[:options]
     // Otherwise we try to load any camera
-    if(argc < 2)
+    if(optind >= argc)
         source = new CameraSource_IIDC (FRAMESOURCE_GRAYSCALE, false, 0, CROP_RECT);
     else if(strncmp(argv[argc-1], "0x", 2) == 0)
     {
@@ -595,9 +1565,9 @@ int main(int argc, char* argv[])
         source = new CameraSource_IIDC(FRAMESOURCE_GRAYSCALE, false, guid, CROP_RECT);
     }
     else
-        source = new FFmpegDecoder(argv[argc-1], FRAMESOURCE_GRAYSCALE, false);
+        source = openSource(argv[argc-1]);
 
-    if(! *source)
+    if(source == NULL || ! *source)
     {
         fprintf(stderr, "couldn't open frame source\n");
         fl_alert("couldn't open frame source");
@@ -605,10 +1575,30 @@ int main(int argc, char* argv[])
         return 0;
     }
 
+    if(cacheFrames)
+    {
+        if(AM_READING_CAMERA)
+        {
+            fprintf(stderr, "--cache-frames only applies to stored videos\n");
+            delete source;
+            return 1;
+        }
+
+        source = new FrameCacheSource(source, cacheFirstFrame, cacheNumFrames, cacheMaxBytes);
+        if(! *source)
+        {
+            fprintf(stderr, "couldn't cache any frames\n");
+            delete source;
+            return 1;
+        }
+        fprintf(stderr, "cached %d frames, starting at frame %d\n",
+                ((FrameCacheSource*)source)->getNumFrames(), cacheFirstFrame);
+    }
+
     Fl_Double_Window* window =
         new Fl_Double_Window(WINDOW_W, WINDOW_H, "Wormtracker 3");
-    widgetImage = new CvFltkWidget(0, 0, source->w(), source->h(),
-                                   WIDGET_COLOR);
+    widgetImage = new TracedCvFltkWidget(0, 0, source->w(), source->h(),
+                                         WIDGET_COLOR);
 
     widgetImage->callback(widgetImageCallback);
 
@@ -634,9 +1624,9 @@ int main(int argc, char* argv[])
                                    2 * BUTTON_W, BUTTON_H);
     goResetButton->callback(pressedGoReset);
 
-    plot = new Ca_Canvas( Y_AXIS_WIDTH + AXIS_EXTRA_SPACE, widgetImage->y() + widgetImage->h(),
-                          PLOT_W, PLOT_H,
-                          "Worm occupancy");
+    plot = new TracedCanvas( Y_AXIS_WIDTH + AXIS_EXTRA_SPACE, widgetImage->y() + widgetImage->h(),
+                             PLOT_W, PLOT_H,
+                             "Worm occupancy");
     plot->align(FL_ALIGN_TOP);
 
     // This is extremely important for some reason. Without it the plots do not refresh property and
@@ -682,12 +1672,23 @@ int main(int argc, char* argv[])
             SETUP_RADIO_BUTTON(orientationLeftRight);
             orientationLeftRight->value(1);
         }
+        Fl_Round_Button* orientationTopBottom;
+        {
+            orientationTopBottom = new Fl_Round_Button(widgetImage->x() + widgetImage->w() + ACCUM_W,
+                                                       goResetButton->y() + goResetButton->h(),
+                                                       ACCUM_W, ACCUM_H, "Top/Bottom");
+            SETUP_RADIO_BUTTON(orientationTopBottom);
+            orientationTopBottom->value(0);
+        }
+
+        // with a grid of arenas, the choice is between the grid and its transpose
+        if(arenaGridRows != 1 || arenaGridCols != 2)
         {
-            Fl_Round_Button* o = new Fl_Round_Button(widgetImage->x() + widgetImage->w() + ACCUM_W,
-                                                     goResetButton->y() + goResetButton->h(),
-                                                     ACCUM_W, ACCUM_H, "Top/Bottom");
-            SETUP_RADIO_BUTTON(o);
-            o->value(0);
+            char label[32];
+            snprintf(label, sizeof(label), "%dx%d grid", arenaGridRows, arenaGridCols);
+            orientationLeftRight->copy_label(label);
+            snprintf(label, sizeof(label), "%dx%d grid", arenaGridCols, arenaGridRows);
+            orientationTopBottom->copy_label(label);
         }
     }
     circleOrientation->end();
@@ -696,22 +1697,24 @@ int main(int argc, char* argv[])
                                               ACCUM_W, ACCUM_H, "Display processed image");
     showProcessedVision->value(1);
 
-    leftAccum  = new Fl_Output(widgetImage->x() + widgetImage->w(), showProcessedVision->y() + showProcessedVision->h(),
-                              ACCUM_W, ACCUM_H, "Left accumulator (ratio-seconds)");
-    rightAccum = new Fl_Output(leftAccum->x(), leftAccum->y() + leftAccum->h(),
-                              ACCUM_W, ACCUM_H, "Right accumulator (ratio-seconds)");
-    leftAccum ->align(FL_ALIGN_RIGHT);
-    rightAccum->align(FL_ALIGN_RIGHT);
-    leftAccum ->labelcolor(FL_RED);
-    rightAccum->labelcolor(FL_GREEN);
+    setupArenaAccumulators(widgetImage->x() + widgetImage->w(), showProcessedVision->y() + showProcessedVision->h());
 
     setupVisionParameters();
+    setupPerformanceHud();
 
     window->resizable(window);
     window->end();
     window->show();
 
-    processingInit(source->w(), source->h());
+    int processingW = source->w() / downsample;
+    int processingH = source->h() / downsample;
+    processingInit(processingW, processingH);
+    arenaMapInit(&arenaMap, processingW, processingH);
+    if(downsample > 1)
+    {
+        downsampledFrame = cvCreateImage(cvSize(processingW, processingH), IPL_DEPTH_8U, 1);
+        upsampledMask    = cvCreateMat(source->h(), source->w(), CV_8UC1);
+    }
 
     changedExperimentName(NULL, NULL);
     setResetAnalysis();
@@ -719,19 +1722,62 @@ int main(int argc, char* argv[])
 
     // I read the data with a tiny delay. This makes sure that I skip old frames (only an issue if I
     // can't keep up with the data rate), but yet got as fast as I can
-    IplImage* buffer = cvCreateImage(cvSize(source->w(), source->h()), IPL_DEPTH_8U, 1);
+    IplImage* buffer = NULL;
 
-    // If reading from a stored video file, go as fast as possible
-    if(AM_READING_CAMERA) source->startSourceThread(&gotNewFrame, 1e6/PREVIEW_FRAME_RATE_FPS, buffer);
-    else                  source->startSourceThread(&gotNewFrame, 0,                          buffer);
+    // If reading from a stored video file, go as fast as possible. The synthetic source paces
+    // itself. The pool holds a frame for each slot of the recording queue, plus the one being
+    // processed, and the one being read
+    PooledFrameSource* pooledSource = dynamic_cast<PooledFrameSource*>(source);
+    if(pooledSource != NULL)
+    {
+        framePool = new FramePool(source->w(), source->h(), RECORDING_QUEUE_LENGTH + 2);
+        pooledSource->startPooledSourceThread(&gotNewPooledFrame, framePool);
+    }
+    else
+    {
+        buffer = cvCreateImage(cvSize(source->w(), source->h()), IPL_DEPTH_8U, 1);
+        if(AM_READING_CAMERA)
+            source->startSourceThread(&gotNewFrame, 1e6/cameraRate_fps, buffer);
+        else
+            source->startSourceThread(&gotNewFrame, 0,                  buffer);
+    }
+
+    if(traceFilename != NULL && !frameTraceStart(traceNumEvents))
+        fprintf(stderr, "couldn't start the timeline trace\n");
+
+    signal(SIGUSR1, requestStatsDump);
+    Fl::add_timeout(STATS_POLL_PERIOD_S, pollStats);
 
     Fl::run();
     Fl::unlock();
 
+    if(traceFilename != NULL && !frameTraceWrite(traceFilename))
+        fprintf(stderr, "couldn't write the timeline trace to '%s'\n", traceFilename);
+
+    frameStatsDump(stderr);
+    if(statsFile != NULL)
+    {
+        frameStatsDump(statsFile);
+        fclose(statsFile);
+    }
+
+    // the recorder may still hold frames from the pool, so it's drained before the pool goes away
+    if(pooledSource != NULL)
+        pooledSource->stopPooledSourceThread();
+    frameWriter.stop();
     delete source;
+    delete framePool;
     delete window;
-    cvReleaseImage(&buffer);
-
+    if(buffer)
+        cvReleaseImage(&buffer);
+    if(arenaMosaic)
+        cvReleaseImage(&arenaMosaic);
+    if(downsampledFrame)
+        cvReleaseImage(&downsampledFrame);
+    if(upsampledMask)
+        cvReleaseMat(&upsampledMask);
+
+    arenaMapRelease(&arenaMap);
     processingCleanup();
     return 0;
 }
@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <string.h>
+#include "maskArchive.h"
+
+typedef struct
+{
+    uint64_t time_us;
+    uint64_t duration_us;
+    uint32_t payloadSize;
+    uint32_t reserved;
+} recordHeader_t;
+
+bool maskArchiveWriterOpen(maskArchiveWriter_t* writer, const char* filename, int w, int h)
+{
+    writer->fp = fopen(filename, "wb");
+    if(writer->fp == NULL)
+        return false;
+
+    writer->width  = w;
+    writer->height = h;
+
+    // worst case: alternating set/unset pixels on every row
+    writer->payload = malloc(h * (1 + 2*((w+1)/2)) * sizeof(uint16_t));
+
+    uint32_t dims[2] = { w, h };
+    if(writer->payload == NULL ||
+       fwrite(MASK_ARCHIVE_MAGIC, 8, 1, writer->fp) != 1 ||
+       fwrite(dims, sizeof(dims), 1, writer->fp)    != 1)
+    {
+        maskArchiveWriterClose(writer);
+        return false;
+    }
+
+    return true;
+}
+
+void maskArchiveWriterClose(maskArchiveWriter_t* writer)
+{
+    if(writer->fp != NULL)
+        fclose(writer->fp);
+    free(writer->payload);
+
+    writer->fp      = NULL;
+    writer->payload = NULL;
+}
+
+bool maskArchiveWriteMask(maskArchiveWriter_t* writer,
+                          const uint8_t* mask, int step,
+                          uint64_t time_us, uint64_t duration_us)
+{
+    if(writer->fp == NULL)
+        return false;
+
+    uint16_t* out = writer->payload;
+
+    for(int y = 0; y < writer->height; y++)
+    {
+        const uint8_t* row = &mask[y*step];
+
+        uint16_t* numRuns = out++;
+        *numRuns = 0;
+
+        int x = 0;
+        while(1)
+        {
+            while(x < writer->width && row[x] == 0) x++;
+            if(x >= writer->width)
+                break;
+
+            *out++ = x;
+            while(x < writer->width && row[x] != 0) x++;
+            *out++ = x;
+
+            (*numRuns)++;
+        }
+    }
+
+    recordHeader_t header = { time_us, duration_us, out - writer->payload, 0 };
+
+    return
+        fwrite(&header, sizeof(header), 1, writer->fp) == 1 &&
+        fwrite(writer->payload, sizeof(uint16_t), header.payloadSize, writer->fp) == header.payloadSize;
+}
+
+bool maskArchiveReaderOpen(maskArchiveReader_t* reader, const char* filename)
+{
+    reader->payload      = NULL;
+    reader->payloadAlloc = 0;
+
+    reader->fp = fopen(filename, "rb");
+    if(reader->fp == NULL)
+        return false;
+
+    char     magic[8];
+    uint32_t dims[2];
+    if(fread(magic, sizeof(magic), 1, reader->fp) != 1 ||
+       memcmp(magic, MASK_ARCHIVE_MAGIC, sizeof(magic)) != 0 ||
+       fread(dims, sizeof(dims), 1, reader->fp) != 1)
+    {
+        maskArchiveReaderClose(reader);
+        return false;
+    }
+
+    reader->width  = dims[0];
+    reader->height = dims[1];
+    return true;
+}
+
+void maskArchiveReaderClose(maskArchiveReader_t* reader)
+{
+    if(reader->fp != NULL)
+        fclose(reader->fp);
+    free(reader->payload);
+
+    reader->fp           = NULL;
+    reader->payload      = NULL;
+    reader->payloadAlloc = 0;
+}
+
+const uint16_t* maskArchiveReadMask(maskArchiveReader_t* reader,
+                                    uint64_t* time_us, uint64_t* duration_us)
+{
+    recordHeader_t header;
+    if(fread(&header, sizeof(header), 1, reader->fp) != 1)
+        return NULL;
+
+    if(header.payloadSize > reader->payloadAlloc)
+    {
+        uint16_t* payload = realloc(reader->payload, header.payloadSize * sizeof(uint16_t));
+        if(payload == NULL)
+            return NULL;
+
+        reader->payload      = payload;
+        reader->payloadAlloc = header.payloadSize;
+    }
+
+    if(fread(reader->payload, sizeof(uint16_t), header.payloadSize, reader->fp) != header.payloadSize)
+        return NULL;
+
+    *time_us     = header.time_us;
+    *duration_us = header.duration_us;
+    return reader->payload;
+}
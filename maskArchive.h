@@ -0,0 +1,53 @@
+#ifndef __MASK_ARCHIVE_H__
+#define __MASK_ARCHIVE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// A run-length-encoded store of the binary masks produced by isolateWorms(). Each mask is stored
+// as a record:
+//
+//   uint64_t time_us       time of this sample, since the start of the run
+//   uint64_t duration_us   how much time this sample accounts for in the accumulators
+//   uint32_t payloadSize   number of uint16_t in the payload
+//   uint32_t reserved
+//   payload: for each row, the number of runs of set pixels n, followed by n (start, end) pairs,
+//            end exclusive
+//
+// The file starts with the magic string "WORMMSK1", followed by the uint32_t width and height. All
+// values are stored in the native byte order
+
+#define MASK_ARCHIVE_MAGIC     "WORMMSK1"
+#define MASK_ARCHIVE_EXTENSION ".masks"
+
+typedef struct
+{
+    FILE*     fp;
+    int       width, height;
+    uint16_t* payload;
+} maskArchiveWriter_t;
+
+typedef struct
+{
+    FILE*     fp;
+    int       width, height;
+    uint16_t* payload;
+    uint32_t  payloadAlloc;
+} maskArchiveReader_t;
+
+bool maskArchiveWriterOpen (maskArchiveWriter_t* writer, const char* filename, int w, int h);
+void maskArchiveWriterClose(maskArchiveWriter_t* writer);
+bool maskArchiveWriteMask  (maskArchiveWriter_t* writer,
+                            const uint8_t* mask, int step,
+                            uint64_t time_us, uint64_t duration_us);
+
+bool maskArchiveReaderOpen (maskArchiveReader_t* reader, const char* filename);
+void maskArchiveReaderClose(maskArchiveReader_t* reader);
+
+// Returns the payload of the next mask, or NULL at the end of the archive. The payload is valid
+// until the next call
+const uint16_t* maskArchiveReadMask(maskArchiveReader_t* reader,
+                                    uint64_t* time_us, uint64_t* duration_us);
+
+#endif
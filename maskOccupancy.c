@@ -0,0 +1,174 @@
+// Recomputes the worm occupancy of a run from its stored masks (written by worm3 --record-masks),
+// for any set of circles. This makes it possible to move the circles after the fact without
+// rerunning the vision processing. Usage:
+//
+//   maskOccupancy [-r radius] run.masks x0,y0 [x1,y1 ...]
+//
+// The occupancy time series is written to stdout in the same format as the data fed to the plot:
+// the time in minutes, followed by the occupancy ratio of each circle. The accumulated occupancy of
+// each circle is reported at the end
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <sys/param.h>
+#include "maskArchive.h"
+
+// same as CIRCLE_RADIUS in worm3
+#define DEFAULT_CIRCLE_RADIUS 52
+
+typedef struct
+{
+    int  x, y;
+
+    // the circle's span on each row of the image, end exclusive. Empty rows have x0 == x1
+    int* x0;
+    int* x1;
+    int  area;
+
+    int    numSet;
+    double accumulator;
+} circle_t;
+
+// The pixels counted here are exactly those arenaMapAddCircle() in wormProcessing.c gives a circle,
+// so the results match those computed live
+static void computeCircleSpans(circle_t* circle, int radius, int width, int height)
+{
+    circle->x0   = calloc(height, sizeof(int));
+    circle->x1   = calloc(height, sizeof(int));
+    circle->area = 0;
+
+    for(int y = MAX(0,        circle->y - radius);
+        y <     MIN(height-1, circle->y + radius);
+        y++)
+    {
+        int dy = y - circle->y;
+        int d  = (int)sqrt((double)(radius*radius - dy*dy));
+        while(d*d + dy*dy > radius*radius)         d--;
+        while((d+1)*(d+1) + dy*dy <= radius*radius) d++;
+
+        int x0 = MAX(MAX(0,       circle->x - radius), circle->x - d);
+        int x1 = MIN(MIN(width-1, circle->x + radius), circle->x + d + 1);
+        if(x1 > x0)
+        {
+            circle->x0[y] = x0;
+            circle->x1[y] = x1;
+            circle->area += x1 - x0;
+        }
+    }
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr, "usage: %s [-r radius] run%s x0,y0 [x1,y1 ...]\n", argv0, MASK_ARCHIVE_EXTENSION);
+}
+
+int main(int argc, char* argv[])
+{
+    int radius = DEFAULT_CIRCLE_RADIUS;
+
+    int opt;
+    while((opt = getopt(argc, argv, "r:")) != -1)
+    {
+        if(opt == 'r')
+            radius = atoi(optarg);
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(argc - optind < 2 || radius <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    maskArchiveReader_t reader;
+    if(!maskArchiveReaderOpen(&reader, argv[optind]))
+    {
+        fprintf(stderr, "couldn't open mask archive '%s'\n", argv[optind]);
+        return 1;
+    }
+
+    int       numCircles = argc - optind - 1;
+    circle_t* circles    = calloc(numCircles, sizeof(circle_t));
+    for(int i=0; i<numCircles; i++)
+    {
+        if(sscanf(argv[optind + 1 + i], "%d,%d", &circles[i].x, &circles[i].y) != 2)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+
+        computeCircleSpans(&circles[i], radius, reader.width, reader.height);
+        if(circles[i].area == 0)
+        {
+            fprintf(stderr, "circle %d lies outside of the %dx%d masks\n",
+                    i, reader.width, reader.height);
+            return 1;
+        }
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    int             numMasks = 0;
+    uint64_t        time_us, duration_us;
+    const uint16_t* payload;
+    while((payload = maskArchiveReadMask(&reader, &time_us, &duration_us)) != NULL)
+    {
+        for(int i=0; i<numCircles; i++)
+            circles[i].numSet = 0;
+
+        for(int y=0; y<reader.height; y++)
+        {
+            int numRuns = *payload++;
+            for(int run=0; run<numRuns; run++, payload += 2)
+            {
+                for(int i=0; i<numCircles; i++)
+                {
+                    int x0 = MAX(payload[0], circles[i].x0[y]);
+                    int x1 = MIN(payload[1], circles[i].x1[y]);
+                    if(x1 > x0)
+                        circles[i].numSet += x1 - x0;
+                }
+            }
+        }
+
+        printf("%f", (double)time_us / 60e6);
+        for(int i=0; i<numCircles; i++)
+        {
+            double occupancy = (double)circles[i].numSet / (double)circles[i].area;
+            circles[i].accumulator += occupancy * (double)duration_us / 1e6;
+            printf(" %f", occupancy);
+        }
+        printf("\n");
+
+        numMasks++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double elapsed = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    printf("# accumulated occupancy (ratio-seconds):");
+    for(int i=0; i<numCircles; i++)
+        printf(" %.3f", circles[i].accumulator);
+    printf("\n");
+
+    fprintf(stderr, "processed %d masks in %.3f s (%.0f masks/s)\n",
+            numMasks, elapsed, elapsed > 0.0 ? numMasks / elapsed : 0.0);
+
+    for(int i=0; i<numCircles; i++)
+    {
+        free(circles[i].x0);
+        free(circles[i].x1);
+    }
+    free(circles);
+    maskArchiveReaderClose(&reader);
+    return 0;
+}
@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <string.h>
+#include "packedMask.h"
+
+#define WORD_ROW(m, y) (&(m)->words[(y)*(m)->wordsPerRow])
+
+void packedMaskInit(packedMask_t* mask, int w, int h)
+{
+    mask->width       = w;
+    mask->height      = h;
+    mask->wordsPerRow = (w + 63) / 64;
+    mask->words       = calloc(mask->wordsPerRow * h, sizeof(uint64_t));
+    mask->columnMasks = malloc(mask->wordsPerRow * sizeof(uint64_t));
+    mask->line        = malloc((mask->wordsPerRow + 2) * sizeof(uint64_t));
+}
+
+void packedMaskRelease(packedMask_t* mask)
+{
+    free(mask->words);
+    free(mask->columnMasks);
+    free(mask->line);
+    mask->words       = NULL;
+    mask->columnMasks = NULL;
+    mask->line        = NULL;
+}
+
+// the bits of word k that lie in rect's columns. rect must cover at least one of them
+static uint64_t getColumnMask(CvRect rect, int k)
+{
+    int lo = MAX(rect.x - 64*k, 0);
+    int hi = MIN(rect.x + rect.width - 64*k, 64);
+
+    uint64_t below_hi = hi >= 64 ? ~0ull : (1ull << hi) - 1;
+    return below_hi & ~((1ull << lo) - 1);
+}
+
+// 8 bytes to 8 bits, a bit for each non-zero byte. The high bit of each byte of nonzero is set if
+// that byte is non-zero. The multiply then gathers those bits into the top byte, in order. This
+// relies on x86 being little-endian
+static uint64_t packBytes(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    uint64_t nonzero = (((v & 0x7f7f7f7f7f7f7f7full) + 0x7f7f7f7f7f7f7f7full) | v) & 0x8080808080808080ull;
+    return ((nonzero >> 7) * 0x0102040810204080ull) >> 56;
+}
+
+// 8 bits to 8 bytes, the reverse of packBytes(): each bit is copied into the high bit of its byte,
+// which is then spread over the whole byte
+static void unpackBytes(uint64_t bits, uint8_t* p, uint64_t value)
+{
+    uint64_t x = ((bits & 0xff) * 0x0101010101010101ull) & 0x8040201008040201ull;
+    uint64_t nonzero = ((x + 0x7f7f7f7f7f7f7f7full) | x) & 0x8080808080808080ull;
+    uint64_t v = ((nonzero >> 7) * 0xff) & value;
+    memcpy(p, &v, 8);
+}
+
+void packMask(const CvMat* src, packedMask_t* dst, CvRect rect)
+{
+    int x0 = rect.x, x1 = rect.x + rect.width;
+    if(rect.width <= 0)
+        return;
+
+    for(int y = rect.y; y < rect.y + rect.height; y++)
+    {
+        const uint8_t* p    = src->data.ptr + y * src->step;
+        uint64_t*      row  = WORD_ROW(dst, y);
+
+        for(int k = x0/64; k <= (x1-1)/64; k++)
+        {
+            int lo = MAX(x0, 64*k), hi = MIN(x1, 64*k + 64);
+            uint64_t bits = 0;
+
+            int x = lo;
+            for(; x < hi && (x & 7); x++)
+                bits |= (uint64_t)(p[x] != 0) << (x & 63);
+            for(; x + 8 <= hi; x += 8)
+                bits |= packBytes(&p[x]) << (x & 63);
+            for(; x < hi; x++)
+                bits |= (uint64_t)(p[x] != 0) << (x & 63);
+
+            uint64_t m = getColumnMask(rect, k);
+            row[k] = (row[k] & ~m) | bits;
+        }
+    }
+}
+
+void unpackMask(const packedMask_t* src, CvMat* dst, CvRect rect, uint8_t value)
+{
+    int x0 = rect.x, x1 = rect.x + rect.width;
+    uint64_t value8 = value * 0x0101010101010101ull;
+
+    for(int y = rect.y; y < rect.y + rect.height; y++)
+    {
+        uint8_t*        p   = dst->data.ptr + y * dst->step;
+        const uint64_t* row = WORD_ROW(src, y);
+
+        int x = x0;
+        for(; x < x1 && (x & 7); x++)
+            p[x] = (row[x/64] >> (x & 63)) & 1 ? value : 0;
+        for(; x + 8 <= x1; x += 8)
+            unpackBytes(row[x/64] >> (x & 63), &p[x], value8);
+        for(; x < x1; x++)
+            p[x] = (row[x/64] >> (x & 63)) & 1 ? value : 0;
+    }
+}
+
+// One pass of the 3x3 erosion (if erode) or dilation (if !erode) over rect. The horizontal pass
+// goes from mask to scratch, the vertical one back into mask, with scratch's row buffers. The pixels
+// outside rect are treated as set when eroding and clear when dilating, so that they don't affect
+// the result
+static void morphologyPass(packedMask_t* mask, packedMask_t* scratch, CvRect rect, int erode)
+{
+    int k0 = rect.x/64, k1 = (rect.x + rect.width - 1)/64;
+    int n  = k1 - k0 + 1;
+    int y0 = rect.y, y1 = rect.y + rect.height;
+
+    const uint64_t outside = erode ? ~0ull : 0ull;
+
+    uint64_t* columnMasks = scratch->columnMasks;
+    for(int i=0; i<n; i++)
+        columnMasks[i] = getColumnMask(rect, k0 + i);
+
+    // the row, with the pixels outside rect neutralized, and a neutral word on either side
+    uint64_t* line = scratch->line;
+    line[0] = line[n+1] = outside;
+
+    for(int y = y0; y < y1; y++)
+    {
+        const uint64_t* src = &WORD_ROW(mask,    y)[k0];
+        uint64_t*       dst = &WORD_ROW(scratch, y)[k0];
+
+        for(int i=0; i<n; i++)
+            line[i+1] = (src[i] & columnMasks[i]) | (outside & ~columnMasks[i]);
+
+        for(int i=1; i<=n; i++)
+        {
+            uint64_t c = line[i];
+            uint64_t l = (c << 1) | (line[i-1] >> 63);
+            uint64_t r = (c >> 1) | (line[i+1] << 63);
+            dst[i-1] = erode ? (c & l & r) : (c | l | r);
+        }
+    }
+
+    for(int y = y0; y < y1; y++)
+    {
+        const uint64_t* restrict above = &WORD_ROW(scratch, MAX(y-1, y0  ))[k0];
+        const uint64_t* restrict here  = &WORD_ROW(scratch, y             )[k0];
+        const uint64_t* restrict below = &WORD_ROW(scratch, MIN(y+1, y1-1))[k0];
+        uint64_t*       restrict dst   = &WORD_ROW(mask,    y             )[k0];
+
+        for(int i=0; i<n; i++)
+        {
+            uint64_t v = erode ? (above[i] & here[i] & below[i]) : (above[i] | here[i] | below[i]);
+            dst[i] = (dst[i] & ~columnMasks[i]) | (v & columnMasks[i]);
+        }
+    }
+}
+
+void packedErode(packedMask_t* mask, packedMask_t* scratch, CvRect rect, int iterations)
+{
+    if(rect.width <= 0 || rect.height <= 0)
+        return;
+    for(int i=0; i<iterations; i++)
+        morphologyPass(mask, scratch, rect, 1);
+}
+
+void packedDilate(packedMask_t* mask, packedMask_t* scratch, CvRect rect, int iterations)
+{
+    if(rect.width <= 0 || rect.height <= 0)
+        return;
+    for(int i=0; i<iterations; i++)
+        morphologyPass(mask, scratch, rect, 0);
+}
@@ -0,0 +1,39 @@
+#ifndef __PACKED_MASK_H__
+#define __PACKED_MASK_H__
+
+#include <stdint.h>
+#include "cvlib.hh"
+
+// A binary mask stored one bit per pixel: pixel (x,y) is bit x%64 of words[y*wordsPerRow + x/64].
+// The bits past the width in the last word of each row are unused. A packed mask is 8 times smaller
+// than the CV_8UC1 masks isolateWorms() produces, so the binary stages that run on it touch 8 times
+// less memory, and process 64 pixels per operation
+typedef struct
+{
+    uint64_t* words;
+    int       width, height;
+    int       wordsPerRow;
+
+    // the row buffers of packedErode() and packedDilate(), used when this is their scratch mask
+    uint64_t* columnMasks; // wordsPerRow
+    uint64_t* line;        // wordsPerRow + 2
+} packedMask_t;
+
+void packedMaskInit   (packedMask_t* mask, int w, int h);
+void packedMaskRelease(packedMask_t* mask);
+
+// These convert the pixels in rect between a CV_8UC1 image the size of the packed mask and the
+// packed mask. A pixel is set if it's non-zero, and is unpacked as value. The bits and pixels outside
+// rect are left alone
+void packMask  (const CvMat* src, packedMask_t* dst, CvRect rect);
+void unpackMask(const packedMask_t* src, CvMat* dst, CvRect rect, uint8_t value);
+
+// cvErode() and cvDilate() with the default 3x3 square element, applied iterations times, to the
+// pixels in rect. rect is treated as the whole image: pixels past its edges are ignored, which is
+// what cvErode() and cvDilate() do at the image edges. Each pass works on whole words: the
+// horizontal neighbours come from shifts, the vertical ones from ANDing or ORing adjacent rows.
+// scratch must be the size of mask. The bits outside rect are left alone
+void packedErode (packedMask_t* mask, packedMask_t* scratch, CvRect rect, int iterations);
+void packedDilate(packedMask_t* mask, packedMask_t* scratch, CvRect rect, int iterations);
+
+#endif
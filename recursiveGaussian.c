@@ -0,0 +1,148 @@
+#include <math.h>
+#include <complex.h>
+#include <string.h>
+#include "recursiveGaussian.h"
+
+double getGaussianSigma(int w)
+{
+    return 0.3*((w - 1)*0.5 - 1) + 0.8;
+}
+
+typedef struct
+{
+    float B;          // gain of the input
+    float b1, b2, b3; // feedback of the 3 previous outputs, already divided by b0
+} coefficients_t;
+
+// The poles of the filter for sigma = 2, from van Vliet, Young and Verbeek, "Recursive Gaussian
+// derivative filters" (ICPR 1998), which fit a Gaussian better than the 1995 coefficients. For other
+// sigmas the poles are raised to the power 1/q, with q chosen so that the variance of the filter is
+// sigma^2
+static const double complex poles[3] = { 1.41650 + 1.00829*I, 1.41650 - 1.00829*I, 1.86543 };
+
+static void scalePoles(double q, double complex scaled[3])
+{
+    for(int i=0; i<3; i++)
+        scaled[i] = cpow(poles[i], 1.0/q);
+}
+
+static double getVariance(const double complex d[3])
+{
+    double complex variance = 0;
+    for(int i=0; i<3; i++)
+        variance += 2.0*d[i] / ((d[i] - 1.0)*(d[i] - 1.0));
+    return creal(variance);
+}
+
+static void getCoefficients(double sigma, coefficients_t* c)
+{
+    // the variance grows monotonically with q, so I bisect
+    double complex d[3];
+    double lo = 0.1, hi = 2.0*sigma + 2.0;
+    for(int i=0; i<60; i++)
+    {
+        double q = 0.5*(lo + hi);
+        scalePoles(q, d);
+        if(getVariance(d) < sigma*sigma) lo = q;
+        else                             hi = q;
+    }
+    scalePoles(0.5*(lo + hi), d);
+
+    // the denominator is (1 - z^-1/d0)(1 - z^-1/d1)(1 - z^-1/d2) = 1 + a1 z^-1 + a2 z^-2 + a3 z^-3
+    double complex p0 = 1.0/d[0], p1 = 1.0/d[1], p2 = 1.0/d[2];
+    double a1 = -creal(p0 + p1 + p2);
+    double a2 =  creal(p0*p1 + p0*p2 + p1*p2);
+    double a3 = -creal(p0*p1*p2);
+
+    c->b1 = -a1;
+    c->b2 = -a2;
+    c->b3 = -a3;
+    c->B  = 1.0 + a1 + a2 + a3; // unity gain at DC
+}
+
+// Filters rows in place, ROW_BLOCK of them at a time. A single row is one long chain of dependent
+// multiply-adds. I thus interleave the rows of a block into a scratch buffer (strip[i*ROW_BLOCK + r]
+// is pixel i of row r), and run the recursion on all of them at once, as vectors. The recursion is
+// seeded with the edge pixels, which is the steady state of a replicated border
+#define ROW_BLOCK RECURSIVE_GAUSSIAN_SCRATCH_ROWS
+static void filterRowBlock(float* rows[ROW_BLOCK], int n, float* restrict strip, const coefficients_t* c)
+{
+    const float B = c->B, b1 = c->b1, b2 = c->b2, b3 = c->b3;
+    float w1[ROW_BLOCK], w2[ROW_BLOCK], w3[ROW_BLOCK];
+
+    for(int i=0; i<n; i++)
+        for(int r=0; r<ROW_BLOCK; r++)
+            strip[i*ROW_BLOCK + r] = rows[r][i];
+
+    for(int r=0; r<ROW_BLOCK; r++)
+        w1[r] = w2[r] = w3[r] = strip[r];
+    for(int i=0; i<n; i++)
+    {
+        float* x = &strip[i*ROW_BLOCK];
+        for(int r=0; r<ROW_BLOCK; r++)
+        {
+            x[r]  = B*x[r] + b1*w1[r] + b2*w2[r] + b3*w3[r];
+            w3[r] = w2[r]; w2[r] = w1[r]; w1[r] = x[r];
+        }
+    }
+
+    for(int r=0; r<ROW_BLOCK; r++)
+        w1[r] = w2[r] = w3[r] = strip[(n-1)*ROW_BLOCK + r];
+    for(int i=n-1; i>=0; i--)
+    {
+        float* x = &strip[i*ROW_BLOCK];
+        for(int r=0; r<ROW_BLOCK; r++)
+        {
+            x[r]  = B*x[r] + b1*w1[r] + b2*w2[r] + b3*w3[r];
+            w3[r] = w2[r]; w2[r] = w1[r]; w1[r] = x[r];
+        }
+    }
+
+    for(int i=0; i<n; i++)
+        for(int r=0; r<ROW_BLOCK; r++)
+            rows[r][i] = strip[i*ROW_BLOCK + r];
+}
+
+#define ROW(m, y) ((float*)((m)->data.ptr + (y)*(m)->step))
+
+// One step of the vertical recursion over a whole row. The inner loop is independent across x, so it
+// vectorizes
+static void filterColumnsStep(float* restrict row,
+                              const float* restrict p1, const float* restrict p2, const float* restrict p3,
+                              int n, const coefficients_t* c)
+{
+    const float B = c->B, b1 = c->b1, b2 = c->b2, b3 = c->b3;
+    for(int x=0; x<n; x++)
+        row[x] = B*row[x] + b1*p1[x] + b2*p2[x] + b3*p3[x];
+}
+
+void recursiveGaussian(const CvMat* src, CvMat* dst, CvMat* scratch, double sigma)
+{
+    int w = src->cols, h = src->rows;
+
+    coefficients_t c;
+    getCoefficients(sigma, &c);
+
+    if(src != dst)
+        for(int y=0; y<h; y++)
+            memcpy(ROW(dst, y), ROW(src, y), w*sizeof(float));
+
+    // the last block repeats the last row to fill itself up. The repeats compute the same values, so
+    // writing them twice is harmless. The strip is the scratch matrix, taken as one contiguous run
+    float* strip = scratch->data.fl;
+    for(int y=0; y<h; y+=ROW_BLOCK)
+    {
+        float* rows[ROW_BLOCK];
+        for(int r=0; r<ROW_BLOCK; r++)
+            rows[r] = ROW(dst, MIN(y + r, h-1));
+        filterRowBlock(rows, w, strip, &c);
+    }
+
+    // The vertical passes run over whole rows at a time, which keeps the accesses sequential. The
+    // edge rows stand in for the rows past the edges. With that seeding, the filter leaves the edge
+    // row itself unchanged, so each pass starts one row in
+    for(int y=1; y<h; y++)
+        filterColumnsStep(ROW(dst, y), ROW(dst, y-1), ROW(dst, MAX(y-2, 0)), ROW(dst, MAX(y-3, 0)), w, &c);
+    for(int y=h-2; y>=0; y--)
+        filterColumnsStep(ROW(dst, y), ROW(dst, y+1), ROW(dst, MIN(y+2, h-1)), ROW(dst, MIN(y+3, h-1)), w, &c);
+}
@@ -0,0 +1,31 @@
+#ifndef __RECURSIVE_GAUSSIAN_H__
+#define __RECURSIVE_GAUSSIAN_H__
+
+#include "cvlib.hh"
+
+// A Gaussian blur whose cost doesn't depend on the kernel width: the third-order recursive filter of
+// Young and van Vliet ("Recursive implementation of the Gaussian filter", Signal Processing 44,
+// 1995), with the better-fitting poles of van Vliet, Young and Verbeek ("Recursive Gaussian
+// derivative filters", ICPR 1998). Each axis is filtered with a causal pass followed by an
+// anti-causal pass, at 4 multiplies per pixel per pass.
+//
+// The image borders are treated as replicated, as cvSmooth() treats them, but the response isn't
+// truncated to the kernel width as cvSmooth()'s is, and seeding the recursion at the edges is only
+// approximate. Compared to cvSmooth(..., CV_GAUSSIAN, w, w) on 8-bit-range float images, more than 3
+// sigma from the edges, the error is at most 2.84% of the input's full scale for w = 5, where the
+// recursive approximation is worst, 1.21% for w = 7, 0.69% for w = 9 and 0.45% for w = 11, and
+// shrinks as w grows. Within 3 sigma of the edges the error reaches 12-15% of full scale. wormBench
+// reports how many mask pixels this changes
+
+// The sigma that cvSmooth() uses for a kernel of width w when none is given
+double getGaussianSigma(int w);
+
+// the rows of the scratch matrix recursiveGaussian() needs
+#define RECURSIVE_GAUSSIAN_SCRATCH_ROWS 32
+
+// Blurs a CV_32FC1 image. src and dst may be the same, and may be views into larger images. scratch
+// is a CV_32FC1 matrix of RECURSIVE_GAUSSIAN_SCRATCH_ROWS rows, at least as wide as src, made by
+// cvCreateMat(), so that its rows are contiguous. It isn't a view
+void recursiveGaussian(const CvMat* src, CvMat* dst, CvMat* scratch, double sigma);
+
+#endif
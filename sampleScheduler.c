@@ -0,0 +1,41 @@
+#include "sampleScheduler.h"
+
+void sampleSchedulerReset(sampleScheduler_t* scheduler, uint64_t period_us)
+{
+    scheduler->period_us       = period_us;
+    scheduler->start_us        = 0;
+    scheduler->lastSample_us   = 0;
+    scheduler->nextDeadline_us = 0;
+    scheduler->numSamples      = 0;
+    scheduler->numMissed       = 0;
+}
+
+bool sampleSchedulerIsDue(const sampleScheduler_t* scheduler, uint64_t timestamp_us)
+{
+    return scheduler->numSamples == 0 || timestamp_us >= scheduler->nextDeadline_us;
+}
+
+void sampleSchedulerTake(sampleScheduler_t* scheduler, uint64_t timestamp_us, sample_t* sample)
+{
+    if(scheduler->numSamples == 0)
+    {
+        // the first sample stands for one period
+        scheduler->start_us        = timestamp_us;
+        scheduler->nextDeadline_us = timestamp_us;
+
+        sample->duration_us = scheduler->period_us;
+    }
+    else
+        sample->duration_us = timestamp_us > scheduler->lastSample_us ?
+            timestamp_us - scheduler->lastSample_us : 0;
+
+    sample->elapsed_us = timestamp_us - scheduler->start_us;
+    sample->jitter_us  = (int64_t)(timestamp_us - scheduler->nextDeadline_us);
+    sample->missed     = sample->jitter_us > 0 ? sample->jitter_us / scheduler->period_us : 0;
+
+    // the deadlines stay on the grid, so lateness doesn't accumulate
+    scheduler->nextDeadline_us += (sample->missed + 1) * scheduler->period_us;
+    scheduler->lastSample_us    = timestamp_us;
+    scheduler->numMissed       += sample->missed;
+    scheduler->numSamples++;
+}
@@ -0,0 +1,37 @@
+#ifndef __SAMPLE_SCHEDULER_H__
+#define __SAMPLE_SCHEDULER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Decides which frames become data samples, based on the frames' timestamps. Sample deadlines are
+// on a fixed grid of period_us, starting at the first sample. Each sample is weighted by the time
+// that actually elapsed since the previous one, so late or missing frames don't skew the
+// accumulated totals
+
+typedef struct
+{
+    uint64_t period_us;
+    uint64_t start_us;
+    uint64_t lastSample_us;
+    uint64_t nextDeadline_us;
+    uint64_t numSamples;
+    uint64_t numMissed;
+} sampleScheduler_t;
+
+typedef struct
+{
+    uint64_t elapsed_us;  // since the first sample
+    uint64_t duration_us; // the time this sample accounts for
+    int64_t  jitter_us;   // how late this sample is, relative to its deadline
+    uint64_t missed;      // how many deadlines passed without a sample just before this one
+} sample_t;
+
+void sampleSchedulerReset(sampleScheduler_t* scheduler, uint64_t period_us);
+bool sampleSchedulerIsDue(const sampleScheduler_t* scheduler, uint64_t timestamp_us);
+
+// Takes a sample at the given time. This is normally called only when sampleSchedulerIsDue(), but
+// can be called for any frame that should be a sample regardless
+void sampleSchedulerTake(sampleScheduler_t* scheduler, uint64_t timestamp_us, sample_t* sample);
+
+#endif
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "syntheticSource.hh"
+
+#define WORM_SEGMENTS       12
+#define WORM_SEGMENT_SPACE  3.0  // pixels between consecutive segments
+#define WORM_RADIUS         3    // pixels
+#define WORM_SPEED          1.5  // pixels per frame
+#define WORM_INTENSITY      60
+#define NOISE_AMPLITUDE     7    // noise is in [-NOISE_AMPLITUDE, NOISE_AMPLITUDE]
+
+struct syntheticWorm_t
+{
+    double x[WORM_SEGMENTS], y[WORM_SEGMENTS];
+    double heading;
+    double phase;
+};
+
+// xorshift32. Fast, and more than random enough for this
+static uint32_t nextRandom(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static double uniformRandom(uint32_t* state)
+{
+    return (double)nextRandom(state) / 4294967296.0;
+}
+
+static uint64_t getMonotonicTime_us(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000ull + t.tv_nsec / 1000;
+}
+
+SyntheticSource::SyntheticSource(int w, int h, double _fps, int _numWorms, uint32_t _seed)
+    : FrameSource(FRAMESOURCE_GRAYSCALE),
+      fps(_fps), numWorms(_numWorms), seed(_seed ? _seed : 1),
+      background(NULL), worms(NULL)
+{
+    if(w <= 4*WORM_SEGMENTS || h <= 4*WORM_SEGMENTS || fps < 0 || numWorms < 0)
+        return;
+
+    width     = w;
+    height    = h;
+    period_us = (uint64_t)(1e6 / (fps > 0 ? fps : SYNTHETIC_NOMINAL_FPS));
+
+    // the illumination: a linear gradient across the frame, darkening towards the corners
+    background = new unsigned char[w*h];
+    for(int y=0; y<h; y++)
+        for(int x=0; x<w; x++)
+        {
+            double dx = (double)x/w - 0.5;
+            double dy = (double)y/h - 0.5;
+            double v  = 170.0 + 40.0*dx - 25.0*dy - 120.0*(dx*dx + dy*dy);
+            background[y*w + x] = (unsigned char)(v < 0.0 ? 0.0 : v > 255.0 ? 255.0 : v);
+        }
+
+    worms = new syntheticWorm_t[numWorms];
+    restartStream();
+}
+
+SyntheticSource::~SyntheticSource()
+{
+    cleanupThreads();
+    stopPooledSourceThread();
+
+    delete[] background;
+    delete[] worms;
+}
+
+SyntheticSource* SyntheticSource::fromDescription(const char* description)
+{
+    if(strncmp(description, "synthetic", 9) != 0 ||
+       (description[9] != '\0' && description[9] != ':'))
+        return NULL;
+
+    int          w = 480, h = 480;
+    double       fps      = SYNTHETIC_NOMINAL_FPS;
+    int          numWorms = 20;
+    unsigned int seed     = 1;
+
+    const char* option = description[9] == ':' ? &description[10] : NULL;
+    while(option != NULL && *option != '\0')
+    {
+        if(sscanf(option, "size=%dx%d", &w, &h)  != 2 &&
+           sscanf(option, "fps=%lf",    &fps)      != 1 &&
+           sscanf(option, "worms=%d",   &numWorms) != 1 &&
+           sscanf(option, "seed=%u",    &seed)     != 1)
+        {
+            fprintf(stderr, "unknown synthetic source option '%s'\n", option);
+            return NULL;
+        }
+
+        option = strchr(option, ',');
+        if(option != NULL)
+            option++;
+    }
+
+    return new SyntheticSource(w, h, fps, numWorms, seed);
+}
+
+bool SyntheticSource::restartStream(void)
+{
+    wormRng      = seed;
+    noiseRng     = seed ^ 0x9e3779b9;
+    frameIndex   = 0;
+    startTime_us = getMonotonicTime_us();
+
+    resetWorms();
+    return true;
+}
+
+void SyntheticSource::resetWorms(void)
+{
+    for(int i=0; i<numWorms; i++)
+    {
+        syntheticWorm_t* worm = &worms[i];
+
+        worm->heading = 2.0 * M_PI * uniformRandom(&wormRng);
+        worm->phase   = 2.0 * M_PI * uniformRandom(&wormRng);
+        worm->x[0]    = WORM_SEGMENTS*WORM_SEGMENT_SPACE + uniformRandom(&wormRng) * (width  - 2*WORM_SEGMENTS*WORM_SEGMENT_SPACE);
+        worm->y[0]    = WORM_SEGMENTS*WORM_SEGMENT_SPACE + uniformRandom(&wormRng) * (height - 2*WORM_SEGMENTS*WORM_SEGMENT_SPACE);
+
+        for(int s=1; s<WORM_SEGMENTS; s++)
+        {
+            worm->x[s] = worm->x[s-1] - WORM_SEGMENT_SPACE * cos(worm->heading);
+            worm->y[s] = worm->y[s-1] - WORM_SEGMENT_SPACE * sin(worm->heading);
+        }
+    }
+}
+
+void SyntheticSource::moveWorms(void)
+{
+    for(int i=0; i<numWorms; i++)
+    {
+        syntheticWorm_t* worm = &worms[i];
+
+        // the head wanders and undulates, and the body follows it
+        worm->phase   += 0.3;
+        worm->heading += 0.15 * (uniformRandom(&wormRng) - 0.5) + 0.1 * sin(worm->phase);
+
+        double x = worm->x[0] + WORM_SPEED * cos(worm->heading);
+        double y = worm->y[0] + WORM_SPEED * sin(worm->heading);
+        if(x < WORM_RADIUS || x >= width  - WORM_RADIUS) { worm->heading = M_PI - worm->heading; continue; }
+        if(y < WORM_RADIUS || y >= height - WORM_RADIUS) { worm->heading =      - worm->heading; continue; }
+        worm->x[0] = x;
+        worm->y[0] = y;
+
+        for(int s=1; s<WORM_SEGMENTS; s++)
+        {
+            double dx = worm->x[s] - worm->x[s-1];
+            double dy = worm->y[s] - worm->y[s-1];
+            double d  = hypot(dx, dy);
+            if(d > WORM_SEGMENT_SPACE)
+            {
+                worm->x[s] = worm->x[s-1] + dx * WORM_SEGMENT_SPACE / d;
+                worm->y[s] = worm->y[s-1] + dy * WORM_SEGMENT_SPACE / d;
+            }
+        }
+    }
+}
+
+void SyntheticSource::render(IplImage* image)
+{
+    for(int y=0; y<height; y++)
+        memcpy(image->imageData + y*image->widthStep, &background[y*width], width);
+
+    for(int i=0; i<numWorms; i++)
+        for(int s=0; s<WORM_SEGMENTS; s++)
+            cvCircle(image, cvPoint(lrint(worms[i].x[s]), lrint(worms[i].y[s])), WORM_RADIUS,
+                     cvScalarAll(WORM_INTENSITY), CV_FILLED, 8);
+
+    for(int y=0; y<height; y++)
+    {
+        unsigned char* row = (unsigned char*)image->imageData + y*image->widthStep;
+        for(int x=0; x<width; x++)
+        {
+            uint32_t r = nextRandom(&noiseRng);
+            int      v = row[x] + (int)(r & 7) + (int)((r >> 3) & 7) - NOISE_AMPLITUDE;
+            row[x] = v < 0 ? 0 : v > 255 ? 255 : v;
+        }
+    }
+}
+
+bool SyntheticSource::_getNextFrame(uint64_t* timestamp_us, IplImage* image)
+{
+    if(fps > 0)
+    {
+        // pace the frames to the requested rate
+        uint64_t due_us = startTime_us + frameIndex * period_us;
+        uint64_t now_us = getMonotonicTime_us();
+        if(due_us > now_us)
+        {
+            struct timespec tv;
+            tv.tv_sec  = (due_us - now_us) / 1000000ull;
+            tv.tv_nsec = ((due_us - now_us) % 1000000ull) * 1000;
+            nanosleep(&tv, NULL);
+        }
+    }
+
+    if(frameIndex != 0)
+        moveWorms();
+    render(image);
+
+    *timestamp_us = frameIndex * period_us;
+    frameIndex++;
+    return true;
+}
+
+bool SyntheticSource::_getLatestFrame(uint64_t* timestamp_us, IplImage* image)
+{
+    return _getNextFrame(timestamp_us, image);
+}
+
+PooledFrame* SyntheticSource::_getNextPooledFrame(FramePool* pool)
+{
+    PooledFrame* frame = pool->acquire();
+    _getNextFrame(&frame->timestamp_us, &frame->image);
+    return frame;
+}
@@ -0,0 +1,55 @@
+#ifndef __SYNTHETIC_SOURCE_HH__
+#define __SYNTHETIC_SOURCE_HH__
+
+#include <stdint.h>
+#include "frameSource.hh"
+#include "framePool.hh"
+
+// A camera stand-in that renders grayscale frames containing dark, wiggling worm-like blobs over an
+// illumination gradient, plus noise. The frames are a deterministic function of the seed and the
+// frame index, so runs are reproducible. The timestamps are synthetic too: frame i is stamped
+// i/fps seconds after the first. With fps == 0 the frames are produced as fast as they're
+// requested, and are stamped as if they came at SYNTHETIC_NOMINAL_FPS
+
+#define SYNTHETIC_NOMINAL_FPS 15
+
+struct syntheticWorm_t;
+
+class SyntheticSource : public FrameSource, public PooledFrameSource
+{
+    double            fps;
+    int               numWorms;
+    uint32_t          seed;
+
+    uint32_t          wormRng, noiseRng;
+    uint64_t          frameIndex;
+    uint64_t          period_us;
+    uint64_t          startTime_us;
+
+    unsigned char*    background;
+    syntheticWorm_t*  worms;
+
+    void resetWorms(void);
+    void moveWorms(void);
+    void render(IplImage* image);
+
+protected:
+    bool _getNextFrame  (uint64_t* timestamp_us, IplImage* image);
+    bool _getLatestFrame(uint64_t* timestamp_us, IplImage* image);
+
+    // the frame is rendered straight into a pool buffer
+    PooledFrame* _getNextPooledFrame(FramePool* pool);
+
+public:
+    SyntheticSource(int w, int h, double fps, int numWorms, uint32_t seed);
+    ~SyntheticSource();
+
+    // Parses a source description of the form "synthetic[:key=value,...]" with the keys size=WxH,
+    // fps=N, worms=N and seed=N. Returns NULL if the description isn't of that form
+    static SyntheticSource* fromDescription(const char* description);
+
+    operator bool() { return background != NULL; }
+    bool restartStream(void);
+};
+
+#endif
@@ -0,0 +1,57 @@
+#include <string.h>
+#include <time.h>
+#include "toolCommon.hh"
+#include "ffmpegInterface.hh"
+#include "frameArchive.hh"
+#include "syntheticSource.hh"
+
+uint64_t getTime_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static bool isSynthetic(const char* name)
+{
+    return strncmp(name, "synthetic", 9) == 0;
+}
+
+static bool endsWith(const char* s, const char* suffix)
+{
+    size_t len       = strlen(s);
+    size_t suffixLen = strlen(suffix);
+    return len >= suffixLen && strcmp(&s[len - suffixLen], suffix) == 0;
+}
+
+FrameSource* openSource(const char* name)
+{
+    if(isSynthetic(name))
+        return SyntheticSource::fromDescription(name);
+    if(endsWith(name, FRAME_ARCHIVE_EXTENSION))
+        return new FrameArchiveSource(name);
+    return new FFmpegDecoder(name, FRAMESOURCE_GRAYSCALE, false);
+}
+
+int getDefaultMaxFrames(const char* sourceName)
+{
+    return isSynthetic(sourceName) ? DEFAULT_SYNTHETIC_FRAMES : 0;
+}
+
+void setDefaultArenas(arena_t* arenas, int* numArenas, int w, int h)
+{
+    *numArenas = 2;
+    for(int i=0; i<*numArenas; i++)
+    {
+        arenas[i].center      = cvPoint(w*(1 + 2*i)/4, h/2);
+        arenas[i].radius      = DEFAULT_CIRCLE_RADIUS;
+        arenas[i].numVertices = 0;
+    }
+}
+
+void makeKernelsOdd(visionParameters_t* params)
+{
+    params->presmoothing_w            |= 1;
+    params->detrend_w                 |= 1;
+    params->adaptive_threshold_kernel |= 1;
+}
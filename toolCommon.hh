@@ -0,0 +1,36 @@
+#ifndef __TOOL_COMMON_HH__
+#define __TOOL_COMMON_HH__
+
+// What worm3 and the standalone tools (wormBench, wormOffline, wormSweep) share: opening a source
+// from a file argument, the default arenas and parameters, and timing
+
+#include <stdint.h>
+#include "frameSource.hh"
+
+extern "C"
+{
+#include "wormProcessing.h"
+#include "arenaFile.h"
+}
+
+#define DEFAULT_SYNTHETIC_FRAMES 200
+#define DEFAULT_CIRCLE_RADIUS    52 /* same as CIRCLE_RADIUS in worm3 */
+
+uint64_t getTime_ns(void);
+
+// the source for a file argument: synthetic[:options], a frame archive or a video. The caller
+// checks the result, and deletes it
+FrameSource* openSource(const char* name);
+
+// The number of frames to use from the source if none is given: DEFAULT_SYNTHETIC_FRAMES for a
+// synthetic source, which never ends, and 0 (all of them) for anything else
+int getDefaultMaxFrames(const char* sourceName);
+
+// two circles of DEFAULT_CIRCLE_RADIUS, at a quarter and three quarters of the width of a w x h
+// frame, as in the default worm3 setup
+void setDefaultArenas(arena_t* arenas, int* numArenas, int w, int h);
+
+// the kernel widths must be odd, as in worm3
+void makeKernelsOdd(visionParameters_t* params);
+
+#endif
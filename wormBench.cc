@@ -0,0 +1,465 @@
+// Micro-benchmarks of the vision pipeline. Each stage of isolateWorms() and computeArenaOccupancy()
+// are timed on synthetic frames of several sizes, with the kernel widths varied around their
+// defaults, for several OpenCV thread counts. The defaults are also timed with only the two arenas
+// processed (isolateWormsSparse()), and that mask is checked against the full-frame one. The defaults
+// and the blur widths are also timed with VISION_SMOOTHING_RECURSIVE, and that mask is compared to
+// the cvSmooth() one. So is the 16-bit fixed-point pipeline, whose mask must be within
+// MAX_FIXED_POINT_DIFFERENCE of the float one, or wormBench fails. adaptiveThresholdMeanInv() is
+// checked against cvAdaptiveThreshold(), which it should match exactly. The cached detrending
+// background is timed, and its change detector is checked. So is the stage cache, whose masks must
+// match recomputing them exactly. Every configuration is warmed up, then timed over several
+// repeats. Usage:
+//
+//   wormBench [-r repeats] [-n frames_per_repeat] > results.tsv
+//
+// A human-readable summary goes to stderr. Tab-separated results go to stdout, one line per
+// configuration and stage, with the median, min and max time per frame over the repeats
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+using namespace std;
+
+#include "syntheticSource.hh"
+#include "toolCommon.hh"
+
+extern "C"
+{
+#include "wormProcessing.h"
+#include "adaptiveThreshold.h"
+}
+
+#define NUM_TEST_FRAMES      8
+#define NUM_WARMUP_FRAMES    10
+#define DEFAULT_REPEATS      7
+#define DEFAULT_FRAMES       20
+
+// how long the cached_detrend configuration keeps its background
+#define CACHED_DETREND_REFRESH_FRAMES 1000
+
+// the largest fraction of the mask allowed to differ between the fixed-point and float pipelines
+#define MAX_FIXED_POINT_DIFFERENCE 0.001
+
+// the two extra "stages" reported along with those in visionStage_t
+#define STAGE_ISOLATE_WORMS  VISION_NUM_STAGES
+#define STAGE_OCCUPANCY      (VISION_NUM_STAGES + 1)
+#define NUM_BENCH_STAGES     (VISION_NUM_STAGES + 2)
+
+static int numRepeats = DEFAULT_REPEATS;
+static int numFrames  = DEFAULT_FRAMES;
+
+// the occupancy is computed over two circles, as in the default worm3 setup
+static arenaMap_t arenaMap;
+
+// if set, only the arenas are processed, as worm3 does while running an analysis
+static bool processArenasOnly = false;
+
+static const char* getStageName(int stage)
+{
+    if(stage == STAGE_ISOLATE_WORMS) return "isolateWorms";
+    if(stage == STAGE_OCCUPANCY)     return "occupancy";
+    return visionStageNames[stage];
+}
+
+static void processFrame(IplImage* frame, visionParameters_t* params,
+                         uint64_t times_ns[NUM_BENCH_STAGES])
+{
+    uint64_t t0 = getTime_ns();
+    if(processArenasOnly)
+        isolateWormsSparse(frame, params, arenaMap.arenaBounds, arenaMap.numArenas, times_ns);
+    else
+        isolateWormsProfiled(frame, params, times_ns);
+    uint64_t t1 = getTime_ns();
+
+    double occupancy[MAX_ARENAS];
+    computeArenaOccupancy(getIsolatedWormsPacked(), &arenaMap, occupancy);
+    uint64_t t2 = getTime_ns();
+
+    times_ns[STAGE_ISOLATE_WORMS] = t1 - t0;
+    times_ns[STAGE_OCCUPANCY]     = t2 - t1;
+}
+
+static int countDifferentPixels(const CvMat* mask0, const CvMat* mask1)
+{
+    int numDifferent = 0;
+    for(int y=0; y<mask0->rows; y++)
+    {
+        const uint8_t* a = mask0->data.ptr + y * mask0->step;
+        const uint8_t* b = mask1->data.ptr + y * mask1->step;
+        for(int x=0; x<mask0->cols; x++)
+            if(a[x] != b[x])
+                numDifferent++;
+    }
+    return numDifferent;
+}
+
+// Counts the mask pixels that differ between two parameter sets over all the test frames
+static int countMaskDifferences(IplImage** frames, const visionParameters_t* params0, const visionParameters_t* params1)
+{
+    visionParameters_t p0 = *params0, p1 = *params1;
+
+    int numDifferent = 0;
+    for(int f=0; f<NUM_TEST_FRAMES; f++)
+    {
+        CvMat* mask0 = cvCloneMat(isolateWorms(frames[f], &p0));
+        numDifferent += countDifferentPixels(mask0, isolateWorms(frames[f], &p1));
+        cvReleaseMat(&mask0);
+    }
+    return numDifferent;
+}
+
+// The cached detrending background. The synthetic illumination is fixed, so the background cached
+// from the first frame only differs from each frame's own by where the worms are, and the masks
+// should be close. Then the lighting is dimmed, which the change detector must catch: the
+// background is recomputed, and that mask must match exactly. Returns the number of differing mask
+// pixels in the dimmed frame
+static int checkCachedDetrend(IplImage** frames, const visionParameters_t* params)
+{
+    visionParameters_t cached = *params, fresh = *params;
+    cached.detrend_refresh_frames = CACHED_DETREND_REFRESH_FRAMES;
+    fresh .detrend_refresh_frames = 1;
+
+    IplImage* dimmed = cvCloneImage(frames[0]);
+    cvConvertScale(frames[0], dimmed, 0.7, 0);
+
+    CvMat* masks[NUM_TEST_FRAMES + 1];
+    for(int f=0; f<NUM_TEST_FRAMES; f++)
+        masks[f] = cvCloneMat(isolateWorms(frames[f], &cached));
+    masks[NUM_TEST_FRAMES] = cvCloneMat(isolateWorms(dimmed, &cached));
+
+    int numDifferent[NUM_TEST_FRAMES + 1];
+    for(int f=0; f<=NUM_TEST_FRAMES; f++)
+    {
+        const CvMat* mask = isolateWorms(f < NUM_TEST_FRAMES ? frames[f] : dimmed, &fresh);
+        numDifferent[f] = countDifferentPixels(masks[f], mask);
+        cvReleaseMat(&masks[f]);
+    }
+    cvReleaseImage(&dimmed);
+
+    int numDifferentSteady = 0;
+    for(int f=0; f<NUM_TEST_FRAMES; f++)
+        numDifferentSteady += numDifferent[f];
+    fprintf(stderr, "%4dx%-4d cached detrending background: %d mask pixels differ from recomputing it, %d after dimming\n",
+            frames[0]->width, frames[0]->height, numDifferentSteady, numDifferent[NUM_TEST_FRAMES]);
+    return numDifferent[NUM_TEST_FRAMES];
+}
+
+// The stage cache. Each parameter is changed in turn on the same frame, as when retuning a paused
+// frame, and each memoized mask must match a full recomputation exactly. The time to retune
+// adaptive_threshold, which only reruns the last two stages, is reported. Returns the number of
+// differing mask pixels
+static int checkMemoized(IplImage** frames, const visionParameters_t* params)
+{
+    static const int frameId = 0;
+
+    visionParameters_t memoized = *params;
+    isolateWormsMemoized(frames[0], frameId, &memoized, NULL, 0, NULL);
+
+    unsigned int visionParameters_t::* fields[] =
+        { &visionParameters_t::adaptive_threshold, &visionParameters_t::adaptive_threshold_kernel,
+          &visionParameters_t::detrend_w,          &visionParameters_t::presmoothing_w,
+          &visionParameters_t::morphologic_depth };
+
+    int numDifferent = 0;
+    for(unsigned int i=0; i<=sizeof(fields)/sizeof(fields[0]); i++)
+    {
+        // the widths must stay odd
+        if(i < sizeof(fields)/sizeof(fields[0])) memoized.*fields[i] += 2;
+        else                                     memoized.detrend_scale *= 0.8;
+
+        CvMat* mask = cvCloneMat(isolateWormsMemoized(frames[0], frameId, &memoized, NULL, 0, NULL));
+        visionParameters_t fresh = memoized;
+        numDifferent += countDifferentPixels(mask, isolateWorms(frames[0], &fresh));
+        cvReleaseMat(&mask);
+    }
+
+    isolateWormsMemoized(frames[0], frameId, &memoized, NULL, 0, NULL);
+    uint64_t t0 = getTime_ns();
+    for(int i=0; i<numFrames; i++)
+    {
+        memoized.adaptive_threshold += i % 2 ? 1 : -1;
+        isolateWormsMemoized(frames[0], frameId, &memoized, NULL, 0, NULL);
+    }
+    uint64_t t1 = getTime_ns();
+
+    fprintf(stderr, "%4dx%-4d stage cache: %d mask pixels differ from recomputing; retuning adaptive_threshold takes %.1f us\n",
+            frames[0]->width, frames[0]->height, numDifferent, (double)(t1 - t0) / numFrames / 1e3);
+    return numDifferent;
+}
+
+// Checks that the fixed-point pipeline's mask is within MAX_FIXED_POINT_DIFFERENCE of the float
+// one, for the defaults and each blur width of the sweeps
+static bool checkFixedPoint(IplImage** frames, const visionParameters_t* params)
+{
+    visionParameters_t fixedParams = *params;
+    fixedParams.precision = VISION_PRECISION_FIXED16;
+
+    int numDifferent = countMaskDifferences(frames, params, &fixedParams);
+    double fraction  = (double)numDifferent / ((double)NUM_TEST_FRAMES * frames[0]->width * frames[0]->height);
+    bool   ok        = fraction <= MAX_FIXED_POINT_DIFFERENCE;
+    fprintf(stderr, "%4dx%-4d fixed point, presmoothing_w %3d, detrend_w %3d: %d mask pixels (%.4f%%) differ from float%s\n",
+            frames[0]->width, frames[0]->height, params->presmoothing_w, params->detrend_w,
+            numDifferent, fraction * 100.0, ok ? "" : ": OVER TOLERANCE");
+    return ok;
+}
+
+// Counts the pixels where adaptiveThresholdMeanInv() and cvAdaptiveThreshold() disagree, over all the
+// test frames and a range of block sizes
+static int checkAdaptiveThreshold(IplImage** frames)
+{
+    adaptiveThresholdScratch_t scratch;
+    adaptiveThresholdScratchInit(&scratch, frames[0]->width);
+
+    int numDifferent = 0;
+    for(int f=0; f<NUM_TEST_FRAMES; f++)
+    {
+        CvMat header;
+        CvMat* frame = cvGetMat(frames[f], &header);
+        CvMat* expected = cvCreateMat(frame->rows, frame->cols, CV_8UC1);
+        CvMat* actual   = cvCreateMat(frame->rows, frame->cols, CV_8UC1);
+
+        for(int blockSize=3; blockSize<=45; blockSize+=6)
+        {
+            cvAdaptiveThreshold(frame, expected, 255, CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY_INV,
+                                blockSize, 15);
+            adaptiveThresholdMeanInv(frame, actual, &scratch, blockSize, 15, 255);
+
+            for(int y=0; y<frame->rows; y++)
+            {
+                const uint8_t* a = expected->data.ptr + y * expected->step;
+                const uint8_t* b = actual->data.ptr   + y * actual->step;
+                for(int x=0; x<frame->cols; x++)
+                    if(a[x] != b[x])
+                        numDifferent++;
+            }
+        }
+
+        cvReleaseMat(&expected);
+        cvReleaseMat(&actual);
+    }
+
+    adaptiveThresholdScratchRelease(&scratch);
+    return numDifferent;
+}
+
+// Checks that processing only the arenas produces the same mask inside the arenas as processing the
+// whole frame. Returns the number of arena pixels that differ over all the test frames
+static int checkArenasOnly(IplImage** frames, visionParameters_t* params)
+{
+    int numDifferent = 0;
+    for(int f=0; f<NUM_TEST_FRAMES; f++)
+    {
+        CvMat* full = cvCloneMat(isolateWorms(frames[f], params));
+        const CvMat* sparse = isolateWormsSparse(frames[f], params, arenaMap.arenaBounds, arenaMap.numArenas, NULL);
+
+        for(int y=0; y<full->rows; y++)
+        {
+            const uint8_t* labels = arenaMap.labels->data.ptr + y * arenaMap.labels->step;
+            const uint8_t* a      = full->data.ptr            + y * full->step;
+            const uint8_t* b      = sparse->data.ptr          + y * sparse->step;
+            for(int x=0; x<full->cols; x++)
+                if(labels[x] != 0 && a[x] != b[x])
+                    numDifferent++;
+        }
+        cvReleaseMat(&full);
+    }
+    return numDifferent;
+}
+
+static void benchmark(IplImage** frames, int threads,
+                      const char* paramName, unsigned int paramValue,
+                      visionParameters_t* params)
+{
+    int w = frames[0]->width;
+    int h = frames[0]->height;
+
+    cvSetNumThreads(threads);
+
+    uint64_t times_ns[NUM_BENCH_STAGES];
+    for(int i=0; i<NUM_WARMUP_FRAMES; i++)
+        processFrame(frames[i % NUM_TEST_FRAMES], params, times_ns);
+
+    // the mean time per frame of each stage, for each repeat
+    vector<double> perRepeat[NUM_BENCH_STAGES];
+    for(int r=0; r<numRepeats; r++)
+    {
+        double sums[NUM_BENCH_STAGES] = {};
+        for(int i=0; i<numFrames; i++)
+        {
+            processFrame(frames[i % NUM_TEST_FRAMES], params, times_ns);
+            for(int s=0; s<NUM_BENCH_STAGES; s++)
+                sums[s] += (double)times_ns[s];
+        }
+
+        for(int s=0; s<NUM_BENCH_STAGES; s++)
+            perRepeat[s].push_back(sums[s] / numFrames);
+    }
+
+    for(int s=0; s<NUM_BENCH_STAGES; s++)
+    {
+        vector<double>& t = perRepeat[s];
+        sort(t.begin(), t.end());
+        double median = t[t.size()/2];
+
+        printf("%dx%d\t%d\t%s\t%u\t%s\t%.0f\t%.0f\t%.0f\t%.3f\t%.1f\n",
+               w, h, threads, paramName, paramValue, getStageName(s),
+               median, t.front(), t.back(), median / (w*h), 1e9 / median);
+
+        if(s == STAGE_ISOLATE_WORMS || s == STAGE_OCCUPANCY)
+            fprintf(stderr, "%4dx%-4d threads %d %-26s %-13s %8.1f us  %6.2f ns/pixel  %8.1f frames/s\n",
+                    w, h, threads, paramName, getStageName(s),
+                    median / 1e3, median / (w*h), 1e9 / median);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    int opt;
+    while((opt = getopt(argc, argv, "r:n:")) != -1)
+    {
+        if     (opt == 'r') numRepeats = atoi(optarg);
+        else if(opt == 'n') numFrames  = atoi(optarg);
+        else
+        {
+            fprintf(stderr, "usage: %s [-r repeats] [-n frames_per_repeat]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(numRepeats < 1) numRepeats = 1;
+    if(numFrames  < 1) numFrames  = 1;
+
+    static const CvSize sizes[] = { cvSize(320, 240), cvSize(480, 480), cvSize(640, 480), cvSize(1280, 960) };
+    static const CvSize kernelSweepSize = cvSize(480, 480);
+
+    // cleared if the fixed-point mask strays too far from the float one anywhere, or if the cached
+    // detrending background isn't refreshed when the lighting changes. The benchmark still runs to
+    // the end, but then fails
+    bool checksOK = true;
+
+    vector<int> threadCounts;
+    threadCounts.push_back(1);
+    threadCounts.push_back(2);
+    threadCounts.push_back(4);
+    int numCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+    if(numCPUs > 4)
+        threadCounts.push_back(numCPUs);
+
+    // the kernel widths are varied one at a time around their defaults
+    struct
+    {
+        const char*                        name;
+        unsigned int visionParameters_t::* field;
+        double                             scales[3];
+        unsigned int                       offsets[3];
+        visionSmoothing_t                  smoothing;
+        visionPrecision_t                  precision;
+    } sweeps[] =
+        {
+            { "presmoothing_w",            &visionParameters_t::presmoothing_w,            {0.5, 1, 2}, {0, 0, 0}, VISION_SMOOTHING_GAUSSIAN,  VISION_PRECISION_FLOAT   },
+            { "detrend_w",                 &visionParameters_t::detrend_w,                 {0.5, 1, 3}, {0, 0, 0}, VISION_SMOOTHING_GAUSSIAN,  VISION_PRECISION_FLOAT   },
+            { "presmoothing_w_recursive",  &visionParameters_t::presmoothing_w,            {0.5, 1, 2}, {0, 0, 0}, VISION_SMOOTHING_RECURSIVE, VISION_PRECISION_FLOAT   },
+            { "detrend_w_recursive",       &visionParameters_t::detrend_w,                 {0.5, 1, 3}, {0, 0, 0}, VISION_SMOOTHING_RECURSIVE, VISION_PRECISION_FLOAT   },
+            { "presmoothing_w_fixed16",    &visionParameters_t::presmoothing_w,            {0.5, 1, 2}, {0, 0, 0}, VISION_SMOOTHING_GAUSSIAN,  VISION_PRECISION_FIXED16 },
+            { "detrend_w_fixed16",         &visionParameters_t::detrend_w,                 {0.5, 1, 3}, {0, 0, 0}, VISION_SMOOTHING_GAUSSIAN,  VISION_PRECISION_FIXED16 },
+            { "adaptive_threshold_kernel", &visionParameters_t::adaptive_threshold_kernel, {0.5, 1, 2}, {0, 0, 0}, VISION_SMOOTHING_GAUSSIAN,  VISION_PRECISION_FLOAT   },
+            { "morphologic_depth",         &visionParameters_t::morphologic_depth,         {1,   1, 1}, {0, 1, 2}, VISION_SMOOTHING_GAUSSIAN,  VISION_PRECISION_FLOAT   }
+        };
+
+    printf("# size\tthreads\tparameter\tvalue\tstage\tmedian_ns\tmin_ns\tmax_ns\tns_per_pixel\tframes_per_s\n");
+
+    for(unsigned int i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++)
+    {
+        int w = sizes[i].width;
+        int h = sizes[i].height;
+
+        SyntheticSource source(w, h, 0, 20, 1);
+        IplImage* frames[NUM_TEST_FRAMES];
+        for(int f=0; f<NUM_TEST_FRAMES; f++)
+        {
+            uint64_t timestamp_us;
+            frames[f] = cvCreateImage(cvSize(w, h), IPL_DEPTH_8U, 1);
+            source.getNextFrame(&timestamp_us, frames[f]);
+        }
+
+        processingInit(w, h);
+        arenaMapInit(&arenaMap, w, h);
+        arenaMapAddCircle(&arenaMap, cvPoint(w/4,   h/2), DEFAULT_CIRCLE_RADIUS);
+        arenaMapAddCircle(&arenaMap, cvPoint(w*3/4, h/2), DEFAULT_CIRCLE_RADIUS);
+
+        fprintf(stderr, "%4dx%-4d adaptive threshold: %d pixels differ from cvAdaptiveThreshold()\n",
+                w, h, checkAdaptiveThreshold(frames));
+
+        for(unsigned int t=0; t<threadCounts.size(); t++)
+        {
+            visionParameters_t params;
+            getDefaultParameters(&params);
+            makeKernelsOdd(&params);
+            benchmark(frames, threadCounts[t], "defaults", 0, &params);
+
+            processArenasOnly = true;
+            benchmark(frames, threadCounts[t], "arenas_only", 1, &params);
+            processArenasOnly = false;
+            if(t == 0)
+                fprintf(stderr, "%4dx%-4d arenas-only processing: %d arena pixels differ from full-frame processing\n",
+                        w, h, checkArenasOnly(frames, &params));
+
+            params.smoothing = VISION_SMOOTHING_RECURSIVE;
+            benchmark(frames, threadCounts[t], "recursive_smoothing", 1, &params);
+            if(t == 0)
+            {
+                visionParameters_t gaussianParams = params;
+                gaussianParams.smoothing = VISION_SMOOTHING_GAUSSIAN;
+                fprintf(stderr, "%4dx%-4d recursive smoothing: %d mask pixels differ from cvSmooth()\n",
+                        w, h, countMaskDifferences(frames, &gaussianParams, &params));
+            }
+
+            params.smoothing = VISION_SMOOTHING_GAUSSIAN;
+            params.precision = VISION_PRECISION_FIXED16;
+            benchmark(frames, threadCounts[t], "fixed_point", 1, &params);
+            params.precision = VISION_PRECISION_FLOAT;
+            if(t == 0 && !checkFixedPoint(frames, &params))
+                checksOK = false;
+
+            params.detrend_refresh_frames = CACHED_DETREND_REFRESH_FRAMES;
+            benchmark(frames, threadCounts[t], "cached_detrend", CACHED_DETREND_REFRESH_FRAMES, &params);
+            params.detrend_refresh_frames = 1;
+            if(t == 0 && checkCachedDetrend(frames, &params) != 0)
+                checksOK = false;
+            if(t == 0 && checkMemoized(frames, &params) != 0)
+                checksOK = false;
+
+
+            if(w != kernelSweepSize.width || h != kernelSweepSize.height)
+                continue;
+
+            for(unsigned int s=0; s<sizeof(sweeps)/sizeof(sweeps[0]); s++)
+                for(int v=0; v<3; v++)
+                {
+                    getDefaultParameters(&params);
+                    params.*sweeps[s].field =
+                        (unsigned int)(params.*sweeps[s].field * sweeps[s].scales[v]) + sweeps[s].offsets[v];
+                    params.smoothing = sweeps[s].smoothing;
+                    params.precision = sweeps[s].precision;
+                    makeKernelsOdd(&params);
+                    benchmark(frames, threadCounts[t], sweeps[s].name, params.*sweeps[s].field, &params);
+
+                    if(t == 0 && sweeps[s].precision == VISION_PRECISION_FIXED16)
+                    {
+                        params.precision = VISION_PRECISION_FLOAT;
+                        if(!checkFixedPoint(frames, &params))
+                            checksOK = false;
+                    }
+                }
+        }
+
+        arenaMapRelease(&arenaMap);
+        processingCleanup();
+        for(int f=0; f<NUM_TEST_FRAMES; f++)
+            cvReleaseImage(&frames[f]);
+    }
+
+    return checksOK ? 0 : 1;
+}
@@ -0,0 +1,237 @@
+// Measures what worm3 --downsample costs in accuracy. A reference video (or a frame archive, or a
+// synthetic source) is processed at full resolution, then again at each downsampling factor, with
+// the parameters and arenas scaled as worm3 scales them. The occupancy of each arena in each frame
+// is compared to the full-resolution one. Usage:
+//
+//   wormOffline [-a arenafile] [-n max_frames] [-d factors] source > report.tsv
+//
+// source is anything worm3 reads from a file: a video, a .frames archive, or
+// synthetic[:options]. A synthetic source should be given fps=0, to not be paced, and only its
+// first max_frames frames are used (DEFAULT_SYNTHETIC_FRAMES by default). The arenas are read from
+// arenafile, in worm3's --arena-file format. Without one, two circles are placed as in wormBench.
+// factors is a comma-separated list. Default: 2,4
+//
+// A human-readable summary goes to stderr. Tab-separated results go to stdout, one line per factor
+// and arena, and one for all the arenas together, with the mean occupancy at full and at reduced
+// resolution, the mean, largest and RMS absolute difference between the two per frame, and the
+// processing time per frame, including the downsampling
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+using namespace std;
+
+#include "toolCommon.hh"
+
+// the occupancy of every arena in every frame of one pass, frame-major
+struct pass_t
+{
+    int            downsample;
+    int            numFrames;
+    vector<double> occupancy;
+    double         time_ns;
+};
+
+static arena_t arenas[MAX_ARENAS];
+static int     numArenas = 0;
+
+// Processes up to maxFrames frames of the source (all of them if maxFrames is 0) at the given
+// downsampling factor. The source is reopened for each pass, so every pass sees the same frames
+static bool runPass(const char* sourceName, int maxFrames, pass_t* pass)
+{
+    FrameSource* source = openSource(sourceName);
+    if(source == NULL || ! *source)
+    {
+        fprintf(stderr, "couldn't open frame source '%s'\n", sourceName);
+        delete source;
+        return false;
+    }
+
+    int d = pass->downsample;
+    int w = source->w(), h = source->h();
+    IplImage* frame       = cvCreateImage(cvSize(w,   h),   IPL_DEPTH_8U, 1);
+    IplImage* downsampled = cvCreateImage(cvSize(w/d, h/d), IPL_DEPTH_8U, 1);
+
+    arenaMap_t arenaMap;
+    processingInit(w/d, h/d);
+    arenaMapInit(&arenaMap, w/d, h/d);
+    arenaMapAddArenas(&arenaMap, arenas, numArenas, d);
+
+    visionParameters_t params;
+    getDefaultParameters(&params);
+    makeKernelsOdd(&params);
+    scaleParameters(&params, d);
+
+    pass->numFrames = 0;
+    pass->time_ns   = 0.0;
+    pass->occupancy.clear();
+
+    uint64_t timestamp_us;
+    while((maxFrames == 0 || pass->numFrames < maxFrames) &&
+          source->getNextFrame(&timestamp_us, frame))
+    {
+        uint64_t t0 = getTime_ns();
+        IplImage* input = frame;
+        if(d > 1)
+        {
+            cvResize(frame, downsampled, CV_INTER_AREA);
+            input = downsampled;
+        }
+        isolateWorms(input, &params);
+
+        double occupancy[MAX_ARENAS];
+        computeArenaOccupancy(getIsolatedWormsPacked(), &arenaMap, occupancy);
+        pass->time_ns += getTime_ns() - t0;
+
+        pass->occupancy.insert(pass->occupancy.end(), occupancy, occupancy + numArenas);
+        pass->numFrames++;
+    }
+
+    arenaMapRelease(&arenaMap);
+    processingCleanup();
+    cvReleaseImage(&frame);
+    cvReleaseImage(&downsampled);
+    delete source;
+
+    if(pass->numFrames == 0)
+    {
+        fprintf(stderr, "couldn't read any frames from '%s'\n", sourceName);
+        return false;
+    }
+    return true;
+}
+
+// compares the given arena (or all of them, if arena < 0) between two passes over the same frames
+static void report(const pass_t* full, const pass_t* pass, int arena)
+{
+    double sumFull = 0.0, sum = 0.0, sumError = 0.0, sumError2 = 0.0, maxError = 0.0;
+    int    n = 0;
+    for(int f=0; f<full->numFrames; f++)
+        for(int i=0; i<numArenas; i++)
+        {
+            if(arena >= 0 && i != arena)
+                continue;
+
+            double a     = full->occupancy[f*numArenas + i];
+            double b     = pass->occupancy[f*numArenas + i];
+            double error = fabs(b - a);
+            sumFull   += a;
+            sum       += b;
+            sumError  += error;
+            sumError2 += error*error;
+            maxError   = max(maxError, error);
+            n++;
+        }
+
+    char arenaName[16];
+    if(arena < 0) strcpy(arenaName, "all");
+    else          snprintf(arenaName, sizeof(arenaName), "%d", arena + 1);
+
+    double ms_per_frame = pass->time_ns / pass->numFrames / 1e6;
+    printf("%d\t%s\t%d\t%.6f\t%.6f\t%.6f\t%.6f\t%.6f\t%.3f\n",
+           pass->downsample, arenaName, full->numFrames,
+           sumFull / n, sum / n, sumError / n, maxError, sqrt(sumError2 / n), ms_per_frame);
+
+    if(arena < 0 && pass != full)
+        fprintf(stderr, "downsample %d: %.3f ms/frame (%.1fx faster), occupancy error mean %.5f, max %.5f\n",
+                pass->downsample, ms_per_frame, full->time_ns / pass->time_ns,
+                sumError / n, maxError);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* arenaFile = NULL;
+    int         maxFrames = 0;
+    vector<int> factors;
+
+    int opt;
+    while((opt = getopt(argc, argv, "a:n:d:")) != -1)
+    {
+        if     (opt == 'a') arenaFile = optarg;
+        else if(opt == 'n') maxFrames = atoi(optarg);
+        else if(opt == 'd')
+        {
+            for(char* token = strtok(optarg, ","); token != NULL; token = strtok(NULL, ","))
+                factors.push_back(atoi(token));
+        }
+        else
+            break;
+    }
+    if(opt != -1 || optind != argc-1)
+    {
+        fprintf(stderr, "usage: %s [-a arenafile] [-n max_frames] [-d factors] source\n", argv[0]);
+        return 1;
+    }
+    const char* sourceName = argv[optind];
+
+    if(factors.empty())
+    {
+        factors.push_back(2);
+        factors.push_back(4);
+    }
+    for(unsigned int i=0; i<factors.size(); i++)
+        if(factors[i] < 2)
+        {
+            fprintf(stderr, "the downsampling factors must be at least 2\n");
+            return 1;
+        }
+
+    if(maxFrames <= 0)
+        maxFrames = getDefaultMaxFrames(sourceName);
+
+    if(arenaFile != NULL)
+    {
+        if(!readArenaFile(arenaFile, arenas, &numArenas))
+            return 1;
+    }
+    else
+    {
+        FrameSource* source = openSource(sourceName);
+        if(source == NULL || ! *source)
+        {
+            fprintf(stderr, "couldn't open frame source '%s'\n", sourceName);
+            delete source;
+            return 1;
+        }
+        int w = source->w(), h = source->h();
+        delete source;
+
+        setDefaultArenas(arenas, &numArenas, w, h);
+    }
+
+    pass_t full;
+    full.downsample = 1;
+    if(!runPass(sourceName, maxFrames, &full))
+        return 1;
+    fprintf(stderr, "full resolution: %d frames, %.3f ms/frame\n",
+            full.numFrames, full.time_ns / full.numFrames / 1e6);
+
+    printf("# downsample\tarena\tframes\tmean_occupancy_full\tmean_occupancy\tmean_abs_error\tmax_abs_error\trms_error\tms_per_frame\n");
+    for(int i=0; i<numArenas; i++)
+        report(&full, &full, i);
+    report(&full, &full, -1);
+
+    for(unsigned int i=0; i<factors.size(); i++)
+    {
+        pass_t pass;
+        pass.downsample = factors[i];
+        if(!runPass(sourceName, maxFrames, &pass))
+            return 1;
+        if(pass.numFrames != full.numFrames)
+        {
+            fprintf(stderr, "downsample %d read %d frames, but the full-resolution pass read %d\n",
+                    pass.downsample, pass.numFrames, full.numFrames);
+            return 1;
+        }
+
+        for(int a=0; a<numArenas; a++)
+            report(&full, &pass, a);
+        report(&full, &pass, -1);
+    }
+
+    return 0;
+}
@@ -1,11 +1,12 @@
 #include <stdint.h>
+#include <time.h>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
 #include "wormProcessing.h"
-
-static int width, height;
-
-static CvMat*         workImage0;
-static CvMat*         workImage1;
-static CvMat*         workImageInt;
+#include "recursiveGaussian.h"
+#include "adaptiveThreshold.h"
+#include "fixedPoint.h"
 
 // these are the defaults
 #define PRESMOOTHING_W            12
@@ -14,22 +15,132 @@ static CvMat*         workImageInt;
 #define ADAPTIVE_THRESHOLD_KERNEL 15
 #define ADAPTIVE_THRESHOLD        15
 #define MORPHOLOGIC_DEPTH         1
+#define DETREND_REFRESH_FRAMES    1
+#define DETREND_REFRESH_CHANGE    0.05
 
-void processingInit(int w, int h)
+// The cached detrending background, in work plane 1. The change detector compares the mean
+// brightness of each cell of a BRIGHTNESS_GRID x BRIGHTNESS_GRID grid over the frame, sampled every
+// BRIGHTNESS_STEP pixels in each direction, to those of the frame the background was computed from
+#define BRIGHTNESS_GRID 8
+#define BRIGHTNESS_STEP 4
+
+struct visionContext_t
 {
-    width  = w;
-    height = h;
+    int width, height;
+
+    CvMat*       workImage0;
+    CvMat*       workImage1;
+    CvMat*       workImageQuotient;
+    CvMat*       workImageDivided;
+    CvMat*       workImageThresholded;
+    CvMat*       workImageInt;
+    CvMat*       workImageFixed0;
+    CvMat*       workImageFixed1;
+    CvMat*       workImageFixedScratch;
+    CvMat*       fixedLineScratch;
+    CvMat*       recursiveScratch;
+    adaptiveThresholdScratch_t thresholdScratch;
+    packedMask_t packedWorms;
+    packedMask_t packedScratch;
+
+    struct
+    {
+        int                valid;
+        visionParameters_t params;
+        CvRect             rects[MAX_ARENAS];
+        int                numRects;
+        unsigned int       age; // frames it has been used for, including the one it was computed for
+        double             brightness[BRIGHTNESS_GRID * BRIGHTNESS_GRID];
+    } background;
+
+    // The stage cache. Each stage writes its own plane, and each entry describes what's in that
+    // plane: the frame and the parameters it was computed from, and the regions it covers. The
+    // convert and presmooth stages share work plane 0, so they're cached together, under
+    // VISION_STAGE_PRESMOOTH. A frame is identified by the id the caller gives it, and by its
+    // brightness grid, which must match exactly, so that an id reused for another frame can't pick
+    // up stale planes
+    struct
+    {
+        int                valid;
+        uint64_t           frameId;
+        double             brightness[BRIGHTNESS_GRID * BRIGHTNESS_GRID];
+        visionParameters_t params;
+        CvRect             rects[MAX_ARENAS];
+        int                numRects;
+    } stageCache[VISION_NUM_STAGES];
+};
+
+// the context of processingInit() and of the calls without a context
+static visionContext_t defaultContext;
+
+static void contextInit(visionContext_t* ctx, int w, int h)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->width  = w;
+    ctx->height = h;
+
+    ctx->workImage0           = cvCreateMat(h, w, CV_32FC1);
+    ctx->workImage1           = cvCreateMat(h, w, CV_32FC1);
+    ctx->workImageQuotient    = cvCreateMat(h, w, CV_32FC1);
+    ctx->workImageDivided     = cvCreateMat(h, w, CV_8UC1);
+    ctx->workImageThresholded = cvCreateMat(h, w, CV_8UC1);
+    ctx->workImageInt         = cvCreateMat(h, w, CV_8UC1);
 
-    workImage0   = cvCreateMat(h, w, CV_32FC1);
-    workImage1   = cvCreateMat(h, w, CV_32FC1);
-    workImageInt = cvCreateMat(h, w, CV_8UC1);
+    ctx->workImageFixed0       = cvCreateMat(h, w, CV_16UC1);
+    ctx->workImageFixed1       = cvCreateMat(h, w, CV_16UC1);
+    ctx->workImageFixedScratch = cvCreateMat(h, w, CV_16UC1);
+    ctx->fixedLineScratch      = cvCreateMat(1, w + FIXED_POINT_MAX_KERNEL_W - 1, CV_16UC1);
+
+    ctx->recursiveScratch = cvCreateMat(RECURSIVE_GAUSSIAN_SCRATCH_ROWS, w, CV_32FC1);
+    adaptiveThresholdScratchInit(&ctx->thresholdScratch, w);
+
+    packedMaskInit(&ctx->packedWorms,   w, h);
+    packedMaskInit(&ctx->packedScratch, w, h);
+}
+
+static void contextCleanup(visionContext_t* ctx)
+{
+    cvReleaseMat(&ctx->workImage0);
+    cvReleaseMat(&ctx->workImage1);
+    cvReleaseMat(&ctx->workImageQuotient);
+    cvReleaseMat(&ctx->workImageDivided);
+    cvReleaseMat(&ctx->workImageThresholded);
+    cvReleaseMat(&ctx->workImageInt);
+    cvReleaseMat(&ctx->workImageFixed0);
+    cvReleaseMat(&ctx->workImageFixed1);
+    cvReleaseMat(&ctx->workImageFixedScratch);
+    cvReleaseMat(&ctx->fixedLineScratch);
+    cvReleaseMat(&ctx->recursiveScratch);
+    adaptiveThresholdScratchRelease(&ctx->thresholdScratch);
+
+    packedMaskRelease(&ctx->packedWorms);
+    packedMaskRelease(&ctx->packedScratch);
+}
+
+void processingInit(int w, int h)
+{
+    contextInit(&defaultContext, w, h);
 }
 
 void processingCleanup(void)
 {
-    cvReleaseMat(&workImage0);
-    cvReleaseMat(&workImage1);
-    cvReleaseMat(&workImageInt);
+    contextCleanup(&defaultContext);
+}
+
+visionContext_t* visionContextCreate(int w, int h)
+{
+    visionContext_t* ctx = (visionContext_t*)malloc(sizeof(*ctx));
+    if(ctx != NULL)
+        contextInit(ctx, w, h);
+    return ctx;
+}
+
+void visionContextRelease(visionContext_t* ctx)
+{
+    if(ctx == NULL)
+        return;
+    contextCleanup(ctx);
+    free(ctx);
 }
 
 void getDefaultParameters(visionParameters_t* params)
@@ -40,67 +151,596 @@ void getDefaultParameters(visionParameters_t* params)
     params->adaptive_threshold_kernel = ADAPTIVE_THRESHOLD_KERNEL;
     params->adaptive_threshold        = ADAPTIVE_THRESHOLD;
     params->morphologic_depth         = MORPHOLOGIC_DEPTH;
+    params->smoothing                 = VISION_SMOOTHING_GAUSSIAN;
+    params->precision                 = VISION_PRECISION_FLOAT;
+    params->detrend_refresh_frames    = DETREND_REFRESH_FRAMES;
+    params->detrend_refresh_change    = DETREND_REFRESH_CHANGE;
+}
+
+// a width of w full-resolution pixels, in pixels of the downsampled frame. w is odd, with w/2 pixels
+// on either side of the center, so I scale that half-width
+static unsigned int scaleKernelWidth(unsigned int w, int downsample, unsigned int minW)
+{
+    unsigned int r = (w/2 + downsample/2) / downsample;
+    return MAX(2*r + 1, minW);
 }
 
+void scaleParameters(visionParameters_t* params, int downsample)
+{
+    if(downsample <= 1)
+        return;
+
+    params->presmoothing_w            = scaleKernelWidth(params->presmoothing_w,            downsample, 1);
+    params->detrend_w                 = scaleKernelWidth(params->detrend_w,                 downsample, 1);
+    // cvAdaptiveThreshold() needs a block of at least 3
+    params->adaptive_threshold_kernel = scaleKernelWidth(params->adaptive_threshold_kernel, downsample, 3);
+
+    // each iteration erodes a pixel, so one iteration at full resolution is half a pixel at 2x. I
+    // round that, but keep at least one, to still remove the speckles the thresholding leaves
+    if(params->morphologic_depth > 0)
+        params->morphologic_depth = MAX((params->morphologic_depth + downsample/2) / downsample, 1u);
+}
+
+const char* const visionStageNames[VISION_NUM_STAGES] =
+    { "convert", "presmooth", "detrend", "divide", "threshold", "morphology" };
+
+static uint64_t getTime_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// marks the end of a stage if we're profiling
+#define STAGE_DONE(stage)                                       \
+    do {                                                        \
+        if(stageTimes_ns != NULL)                               \
+        {                                                       \
+            uint64_t t1 = getTime_ns();                         \
+            stageTimes_ns[stage] = t1 - t0;                     \
+            t0 = t1;                                            \
+        }                                                       \
+    } while(0)
+
 const CvMat* isolateWorms(const IplImage* input,
                           visionParameters_t* params)
 {
-    cvConvert(input, workImage0);
-    cvSmooth(workImage0, workImage0, CV_GAUSSIAN, params->presmoothing_w, params->presmoothing_w, 0, 0);
-    cvSmooth(workImage0, workImage1, CV_GAUSSIAN, params->detrend_w,      params->detrend_w,      0, 0);
-    cvDiv(workImage0, workImage1, workImage0, params->detrend_scale);
+    return isolateWormsProfiled(input, params, NULL);
+}
 
-    cvConvert(workImage0, workImageInt);
+const CvMat* isolateWormsProfiled(const IplImage* input,
+                                  visionParameters_t* params,
+                                  uint64_t stageTimes_ns[VISION_NUM_STAGES])
+{
+    return isolateWormsSparse(input, params, NULL, 0, stageTimes_ns);
+}
 
-    cvAdaptiveThreshold(workImageInt, workImageInt,
-                        255,CV_ADAPTIVE_THRESH_MEAN_C,
-                        CV_THRESH_BINARY_INV,
-                        params->adaptive_threshold_kernel, params->adaptive_threshold);
+// The radius of support of a blur of width w. The recursive filter's response never quite ends, so
+// I cut it off at 4 sigma, past which its tails hold under 1e-4 of the weight
+static int getSmoothingRadius(const visionParameters_t* params, int w)
+{
+    if(params->smoothing == VISION_SMOOTHING_RECURSIVE && params->precision == VISION_PRECISION_FLOAT)
+        return (int)ceil(4.0 * getGaussianSigma(w));
+    return w/2;
+}
 
-    cvErode (workImageInt, workImageInt, NULL, params->morphologic_depth);
-    cvDilate(workImageInt, workImageInt, NULL, params->morphologic_depth);
+static void smooth(visionContext_t* ctx, const visionParameters_t* params,
+                   const CvMat* src, CvMat* dst, CvMat* fixedScratch, int w)
+{
+    if(params->precision == VISION_PRECISION_FIXED16)
+        fixedPointGaussian(src, dst, fixedScratch, ctx->fixedLineScratch, w);
+    else if(params->smoothing == VISION_SMOOTHING_RECURSIVE)
+        recursiveGaussian(src, dst, ctx->recursiveScratch, getGaussianSigma(w));
+    else
+        cvSmooth(src, dst, CV_GAUSSIAN, w, w, 0, 0);
+}
 
-    return workImageInt;
+int getProcessingHalo(const visionParameters_t* params)
+{
+    // an output pixel depends on the input pixels within the sum of the radii of the stages. The
+    // morphology is an erosion and a dilation, each with a 3x3 element applied morphologic_depth
+    // times
+    return getSmoothingRadius(params, params->presmoothing_w) + getSmoothingRadius(params, params->detrend_w) +
+        params->adaptive_threshold_kernel/2 + 2*params->morphologic_depth;
 }
 
-static double computeOccupancySingleCircle(const CvMat* isolatedWorms,
-                                           const CvPoint* circle, int circleRadius)
+static int rectsOverlap(CvRect a, CvRect b)
 {
-    int numInCircle = 0;
-    int numWormsInCircle = 0;
+    return a.x < b.x + b.width  && b.x < a.x + a.width &&
+           a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+static CvRect rectUnion(CvRect a, CvRect b)
+{
+    int x0 = MIN(a.x, b.x), x1 = MAX(a.x + a.width,  b.x + b.width);
+    int y0 = MIN(a.y, b.y), y1 = MAX(a.y + a.height, b.y + b.height);
+    return cvRect(x0, y0, x1 - x0, y1 - y0);
+}
+
+static int rectContains(CvRect outer, CvRect inner)
+{
+    return inner.x >= outer.x && inner.x + inner.width  <= outer.x + outer.width &&
+           inner.y >= outer.y && inner.y + inner.height <= outer.y + outer.height;
+}
 
-    for(int y = MAX(0,        circle->y - circleRadius);
-        y <     MIN(height-1, circle->y + circleRadius);
-        y++)
+// whether every one of rects lies inside one of the covering rects
+static int rectsCovered(const CvRect* rects, int numRects, const CvRect* covering, int numCovering)
+{
+    for(int i=0; i<numRects; i++)
     {
-        int dy = y - circle->y;
+        int covered = 0;
+        for(int j=0; j<numCovering && !covered; j++)
+            covered = rectContains(covering[j], rects[i]);
+        if(!covered)
+            return 0;
+    }
+    return 1;
+}
 
-        const uint8_t* data = (const uint8_t*)(isolatedWorms->data.ptr + y * isolatedWorms->step);
+static void getBrightness(const visionContext_t* ctx, const IplImage* input,
+                          double brightness[BRIGHTNESS_GRID * BRIGHTNESS_GRID])
+{
+    int width = ctx->width, height = ctx->height;
+
+    uint32_t sums  [BRIGHTNESS_GRID * BRIGHTNESS_GRID] = {0};
+    uint32_t counts[BRIGHTNESS_GRID * BRIGHTNESS_GRID] = {0};
 
-        for(int x = MAX(0,        circle->x - circleRadius);
-            x <     MIN(width-1,  circle->x + circleRadius);
-            x++)
+    for(int y=0; y<height; y+=BRIGHTNESS_STEP)
+    {
+        const uint8_t* row  = (const uint8_t*)input->imageData + y * input->widthStep;
+        int            cell = y * BRIGHTNESS_GRID / height * BRIGHTNESS_GRID;
+        for(int x=0; x<width; x+=BRIGHTNESS_STEP)
         {
-            int dx = x - circle->x;
-            if(dx*dx + dy*dy <= circleRadius*circleRadius)
+            sums  [cell + x * BRIGHTNESS_GRID / width] += row[x];
+            counts[cell + x * BRIGHTNESS_GRID / width]++;
+        }
+    }
+
+    for(int i=0; i<BRIGHTNESS_GRID * BRIGHTNESS_GRID; i++)
+        brightness[i] = counts[i] > 0 ? (double)sums[i] / (double)counts[i] : 0.0;
+}
+
+// Decides whether the cached background can be used for this frame
+static int isBackgroundStale(const visionContext_t* ctx,
+                             const visionParameters_t* params, const CvRect* rects, int numRects,
+                             const double brightness[BRIGHTNESS_GRID * BRIGHTNESS_GRID])
+{
+    if(!ctx->background.valid || params->detrend_refresh_frames <= 1 ||
+       ctx->background.age >= params->detrend_refresh_frames)
+        return 1;
+
+    // the background depends on these, but not on the rest of the parameters
+    const visionParameters_t* cached = &ctx->background.params;
+    if(params->presmoothing_w != cached->presmoothing_w ||
+       params->detrend_w      != cached->detrend_w      ||
+       params->smoothing      != cached->smoothing      ||
+       params->precision      != cached->precision)
+        return 1;
+
+    // every region must have been computed before
+    if(!rectsCovered(rects, numRects, ctx->background.rects, ctx->background.numRects))
+        return 1;
+
+    for(int i=0; i<BRIGHTNESS_GRID * BRIGHTNESS_GRID; i++)
+        if(fabs(brightness[i] - ctx->background.brightness[i]) >
+           params->detrend_refresh_change * MAX(ctx->background.brightness[i], 1.0))
+            return 1;
+
+    return 0;
+}
+
+// Grows each region by the halo and clips it to the frame. Overlapping regions are then merged, so
+// that no region's halo, which isn't computed exactly, overwrites another region's result
+static int expandRegions(const visionContext_t* ctx,
+                         const CvRect* regions, int numRegions, int halo, CvRect* expanded)
+{
+    int width = ctx->width, height = ctx->height;
+
+    int numExpanded = 0;
+    for(int i=0; i<numRegions; i++)
+    {
+        int x0 = MAX(regions[i].x - halo, 0);
+        int y0 = MAX(regions[i].y - halo, 0);
+        int x1 = MIN(regions[i].x + regions[i].width  + halo, width);
+        int y1 = MIN(regions[i].y + regions[i].height + halo, height);
+        if(x1 > x0 && y1 > y0)
+            expanded[numExpanded++] = cvRect(x0, y0, x1 - x0, y1 - y0);
+    }
+
+    int merged;
+    do
+    {
+        merged = 0;
+        for(int i=0; i<numExpanded && !merged; i++)
+            for(int j=i+1; j<numExpanded && !merged; j++)
+                if(rectsOverlap(expanded[i], expanded[j]))
+                {
+                    expanded[i] = rectUnion(expanded[i], expanded[j]);
+                    expanded[j] = expanded[--numExpanded];
+                    merged = 1;
+                }
+    } while(merged);
+
+    return numExpanded;
+}
+
+// Whether the parameters the given stage depends on, directly or through the stages before it, are
+// the same in a and b
+static int sameStageParameters(visionStage_t stage, const visionParameters_t* a, const visionParameters_t* b)
+{
+    switch(stage)
+    {
+    case VISION_STAGE_MORPHOLOGY:
+        if(a->morphologic_depth != b->morphologic_depth)
+            return 0;
+        // fall through
+    case VISION_STAGE_THRESHOLD:
+        if(a->adaptive_threshold_kernel != b->adaptive_threshold_kernel ||
+           a->adaptive_threshold        != b->adaptive_threshold)
+            return 0;
+        // fall through
+    case VISION_STAGE_DIVIDE:
+        if(a->detrend_scale != b->detrend_scale)
+            return 0;
+        // fall through
+    case VISION_STAGE_DETREND:
+        if(a->detrend_w != b->detrend_w)
+            return 0;
+        // fall through
+    default:
+        return a->presmoothing_w == b->presmoothing_w &&
+               a->smoothing      == b->smoothing      &&
+               a->precision      == b->precision;
+    }
+}
+
+static int isStageCached(const visionContext_t* ctx, visionStage_t stage, uint64_t frameId,
+                         const double brightness[BRIGHTNESS_GRID * BRIGHTNESS_GRID],
+                         const visionParameters_t* params, const CvRect* rects, int numRects)
+{
+    return frameId != VISION_FRAME_UNKNOWN &&
+           ctx->stageCache[stage].valid && ctx->stageCache[stage].frameId == frameId &&
+           memcmp(ctx->stageCache[stage].brightness, brightness, sizeof(ctx->stageCache[stage].brightness)) == 0 &&
+           sameStageParameters(stage, params, &ctx->stageCache[stage].params) &&
+           rectsCovered(rects, numRects, ctx->stageCache[stage].rects, ctx->stageCache[stage].numRects);
+}
+
+static void cacheStage(visionContext_t* ctx, visionStage_t stage, uint64_t frameId,
+                       const double brightness[BRIGHTNESS_GRID * BRIGHTNESS_GRID],
+                       const visionParameters_t* params, const CvRect* rects, int numRects)
+{
+    ctx->stageCache[stage].valid    = frameId != VISION_FRAME_UNKNOWN;
+    ctx->stageCache[stage].frameId  = frameId;
+    ctx->stageCache[stage].params   = *params;
+    ctx->stageCache[stage].numRects = numRects;
+    memcpy(ctx->stageCache[stage].brightness, brightness, sizeof(ctx->stageCache[stage].brightness));
+    memcpy(ctx->stageCache[stage].rects,      rects,      numRects * sizeof(rects[0]));
+}
+
+const CvMat* isolateWormsSparse(const IplImage* input,
+                                visionParameters_t* params,
+                                const CvRect* regions, int numRegions,
+                                uint64_t stageTimes_ns[VISION_NUM_STAGES])
+{
+    return isolateWormsMemoized(input, VISION_FRAME_UNKNOWN, params, regions, numRegions, stageTimes_ns);
+}
+
+const CvMat* isolateWormsMemoized(const IplImage* input, uint64_t frameId,
+                                  visionParameters_t* params,
+                                  const CvRect* regions, int numRegions,
+                                  uint64_t stageTimes_ns[VISION_NUM_STAGES])
+{
+    return isolateWormsInContext(&defaultContext, input, frameId, params, regions, numRegions, stageTimes_ns);
+}
+
+const CvMat* isolateWormsInContext(visionContext_t* ctx,
+                                   const IplImage* input, uint64_t frameId,
+                                   visionParameters_t* params,
+                                   const CvRect* regions, int numRegions,
+                                   uint64_t stageTimes_ns[VISION_NUM_STAGES])
+{
+    uint64_t t0 = stageTimes_ns != NULL ? getTime_ns() : 0;
+
+    CvRect rects[MAX_ARENAS];
+    if(numRegions <= 0)
+    {
+        rects[0]   = cvRect(0, 0, ctx->width, ctx->height);
+        numRegions = 1;
+    }
+    else
+        numRegions = expandRegions(ctx, regions, MIN(numRegions, MAX_ARENAS), getProcessingHalo(params), rects);
+
+    // every stage works on views of the regions of the work planes. work0 and work1 are the float or
+    // the fixed-point planes, depending on the precision
+    int fixedPoint = params->precision == VISION_PRECISION_FIXED16;
+    CvMat in[MAX_ARENAS], work0[MAX_ARENAS], work1[MAX_ARENAS], fixedScratch[MAX_ARENAS];
+    CvMat quotient[MAX_ARENAS], divided[MAX_ARENAS], thresholded[MAX_ARENAS];
+    for(int i=0; i<numRegions; i++)
+    {
+        cvGetSubRect(input,                                               &in[i],           rects[i]);
+        cvGetSubRect(fixedPoint ? ctx->workImageFixed0 : ctx->workImage0, &work0[i],        rects[i]);
+        cvGetSubRect(fixedPoint ? ctx->workImageFixed1 : ctx->workImage1, &work1[i],        rects[i]);
+        cvGetSubRect(ctx->workImageFixedScratch,                          &fixedScratch[i], rects[i]);
+        cvGetSubRect(ctx->workImageQuotient,                              &quotient[i],     rects[i]);
+        cvGetSubRect(ctx->workImageDivided,                               &divided[i],      rects[i]);
+        cvGetSubRect(ctx->workImageThresholded,                           &thresholded[i],  rects[i]);
+    }
+
+    // the brightness grid is needed to validate the stage cache, and the cached background
+    double brightness[BRIGHTNESS_GRID * BRIGHTNESS_GRID] = {0};
+    int    caching = params->detrend_refresh_frames > 1;
+    if(caching || frameId != VISION_FRAME_UNKNOWN)
+        getBrightness(ctx, input, brightness);
+
+    // Each stage is skipped if its plane already holds its output for this frame, which is only
+    // possible if the stages before it were skipped too
+    int cached = isStageCached(ctx, VISION_STAGE_PRESMOOTH, frameId, brightness, params, rects, numRegions);
+    if(!cached)
+        for(int i=0; i<numRegions; i++)
+        {
+            if(fixedPoint) fixedPointConvert(&in[i], &work0[i]);
+            else           cvConvert        (&in[i], &work0[i]);
+        }
+    STAGE_DONE(VISION_STAGE_CONVERT);
+
+    if(!cached)
+    {
+        for(int i=0; i<numRegions; i++)
+            smooth(ctx, params, &work0[i], &work0[i], &fixedScratch[i], params->presmoothing_w);
+        cacheStage(ctx, VISION_STAGE_PRESMOOTH, frameId, brightness, params, rects, numRegions);
+    }
+    STAGE_DONE(VISION_STAGE_PRESMOOTH);
+
+    cached = cached && isStageCached(ctx, VISION_STAGE_DETREND, frameId, brightness, params, rects, numRegions);
+    if(!cached)
+    {
+        if(!caching || isBackgroundStale(ctx, params, rects, numRegions, brightness))
+        {
+            for(int i=0; i<numRegions; i++)
+                smooth(ctx, params, &work0[i], &work1[i], &fixedScratch[i], params->detrend_w);
+
+            ctx->background.valid    = caching;
+            ctx->background.params   = *params;
+            ctx->background.numRects = numRegions;
+            ctx->background.age      = 1;
+            memcpy(ctx->background.rects, rects, numRegions * sizeof(rects[0]));
+            if(caching)
+                memcpy(ctx->background.brightness, brightness, sizeof(brightness));
+        }
+        else
+            ctx->background.age++;
+        cacheStage(ctx, VISION_STAGE_DETREND, frameId, brightness, params, rects, numRegions);
+    }
+    STAGE_DONE(VISION_STAGE_DETREND);
+
+    cached = cached && isStageCached(ctx, VISION_STAGE_DIVIDE, frameId, brightness, params, rects, numRegions);
+    if(!cached)
+    {
+        for(int i=0; i<numRegions; i++)
+        {
+            if(fixedPoint)
+                fixedPointDivide(&work0[i], &work1[i], &divided[i], params->detrend_scale);
+            else
             {
-                numInCircle++;
+                cvDiv(&work0[i], &work1[i], &quotient[i], params->detrend_scale);
+                cvConvert(&quotient[i], &divided[i]);
+            }
+        }
+        cacheStage(ctx, VISION_STAGE_DIVIDE, frameId, brightness, params, rects, numRegions);
+    }
+    STAGE_DONE(VISION_STAGE_DIVIDE);
+
+    cached = cached && isStageCached(ctx, VISION_STAGE_THRESHOLD, frameId, brightness, params, rects, numRegions);
+    if(!cached)
+    {
+        for(int i=0; i<numRegions; i++)
+            adaptiveThresholdMeanInv(&divided[i], &thresholded[i], &ctx->thresholdScratch,
+                                     params->adaptive_threshold_kernel, params->adaptive_threshold, 255);
+        cacheStage(ctx, VISION_STAGE_THRESHOLD, frameId, brightness, params, rects, numRegions);
+    }
+    STAGE_DONE(VISION_STAGE_THRESHOLD);
+
+    // the morphology runs on the packed mask. Each region is treated as its own image, which only
+    // differs from cvErode() and cvDilate() on the views within the halo
+    cached = cached && isStageCached(ctx, VISION_STAGE_MORPHOLOGY, frameId, brightness, params, rects, numRegions);
+    if(!cached)
+    {
+        for(int i=0; i<numRegions; i++)
+        {
+            packMask(ctx->workImageThresholded, &ctx->packedWorms, rects[i]);
+            packedErode (&ctx->packedWorms, &ctx->packedScratch, rects[i], params->morphologic_depth);
+            packedDilate(&ctx->packedWorms, &ctx->packedScratch, rects[i], params->morphologic_depth);
+            unpackMask(&ctx->packedWorms, ctx->workImageInt, rects[i], 255);
+        }
+        cacheStage(ctx, VISION_STAGE_MORPHOLOGY, frameId, brightness, params, rects, numRegions);
+    }
+    STAGE_DONE(VISION_STAGE_MORPHOLOGY);
+
+    return ctx->workImageInt;
+}
+
+const packedMask_t* getIsolatedWormsPacked(void)
+{
+    return getContextWormsPacked(&defaultContext);
+}
+
+const packedMask_t* getContextWormsPacked(const visionContext_t* ctx)
+{
+    return &ctx->packedWorms;
+}
+
+void arenaMapInit(arenaMap_t* map, int w, int h)
+{
+    map->labels  = cvCreateMat(h, w, CV_8UC1);
+    map->scratch = cvCreateMat(h, w, CV_8UC1);
+    map->numArenas = 0;
+    arenaMapClear(map);
+}
+
+void arenaMapRelease(arenaMap_t* map)
+{
+    arenaMapClear(map);
+    cvReleaseMat(&map->labels);
+    cvReleaseMat(&map->scratch);
+}
+
+void arenaMapClear(arenaMap_t* map)
+{
+    for(int i=0; i<map->numArenas; i++)
+        packedMaskRelease(&map->arenaMasks[i]);
+
+    cvZero(map->labels);
+    map->bounds    = cvRect(0, 0, 0, 0);
+    map->numArenas = 0;
+}
+
+static void growBounds(arenaMap_t* map, int x0, int y0, int x1, int y1)
+{
+    if(map->bounds.width == 0 || map->bounds.height == 0)
+    {
+        map->bounds = cvRect(x0, y0, x1 - x0, y1 - y0);
+        return;
+    }
+
+    int bx1 = MAX(map->bounds.x + map->bounds.width,  x1);
+    int by1 = MAX(map->bounds.y + map->bounds.height, y1);
+    map->bounds.x      = MIN(map->bounds.x, x0);
+    map->bounds.y      = MIN(map->bounds.y, y0);
+    map->bounds.width  = bx1 - map->bounds.x;
+    map->bounds.height = by1 - map->bounds.y;
+}
+
+// packs the pixels of the given arena from the label map
+static void packArena(arenaMap_t* map, int arena)
+{
+    CvRect        bounds = map->arenaBounds[arena];
+    packedMask_t* mask   = &map->arenaMasks[arena];
+    uint8_t       label  = arena + 1;
+
+    if(bounds.width <= 0 || bounds.height <= 0)
+    {
+        packedMaskInit(mask, 0, 0);
+        return;
+    }
+
+    int x0 = bounds.x / 64 * 64;
+    packedMaskInit(mask, bounds.x + bounds.width - x0, bounds.height);
+    for(int y = 0; y < bounds.height; y++)
+    {
+        const uint8_t* labels = map->labels->data.ptr + (bounds.y + y) * map->labels->step;
+        uint64_t*      words  = &mask->words[y * mask->wordsPerRow];
+        for(int x = bounds.x; x < bounds.x + bounds.width; x++)
+            if(labels[x] == label)
+                words[(x - x0)/64] |= 1ull << ((x - x0) & 63);
+    }
+}
+
+int arenaMapAddCircle(arenaMap_t* map, CvPoint center, int radius)
+{
+    if(map->numArenas >= MAX_ARENAS)
+        return -1;
+
+    int     arena = map->numArenas++;
+    uint8_t label = arena + 1;
+    int     numPixels = 0;
+    int     w = map->labels->cols, h = map->labels->rows;
+
+    // the circle worm3 has always counted: the bounding box, short of its last row and column,
+    // intersected with the disc. maskOccupancy counts the same pixels
+    int x0 = MAX(0, center.x - radius), x1 = MIN(w-1, center.x + radius);
+    int y0 = MAX(0, center.y - radius), y1 = MIN(h-1, center.y + radius);
+    for(int y = y0; y < y1; y++)
+    {
+        int dy = y - center.y;
+        uint8_t* labels = map->labels->data.ptr + y * map->labels->step;
 
-                if(data[x] != 0)
-                    numWormsInCircle++;
+        for(int x = x0; x < x1; x++)
+        {
+            int dx = x - center.x;
+            if(dx*dx + dy*dy <= radius*radius && labels[x] == 0)
+            {
+                labels[x] = label;
+                numPixels++;
             }
         }
     }
 
-    return (double)numWormsInCircle / (double)numInCircle;
+    map->numPixels[arena]   = numPixels;
+    map->arenaBounds[arena] = cvRect(x0, y0, MAX(x1 - x0, 0), MAX(y1 - y0, 0));
+    packArena(map, arena);
+    if(x1 > x0 && y1 > y0)
+        growBounds(map, x0, y0, x1, y1);
+    return arena;
 }
 
+int arenaMapAddPolygon(arenaMap_t* map, const CvPoint* vertices, int numVertices)
+{
+    if(map->numArenas >= MAX_ARENAS || numVertices < 3)
+        return -1;
+
+    int     arena = map->numArenas++;
+    uint8_t label = arena + 1;
+    int     numPixels = 0;
+    int     w = map->labels->cols, h = map->labels->rows;
+
+    int x0 = w, y0 = h, x1 = 0, y1 = 0;
+    for(int i=0; i<numVertices; i++)
+    {
+        x0 = MIN(x0, vertices[i].x);
+        y0 = MIN(y0, vertices[i].y);
+        x1 = MAX(x1, vertices[i].x + 1);
+        y1 = MAX(y1, vertices[i].y + 1);
+    }
+    x0 = MAX(x0, 0); x1 = MIN(x1, w);
+    y0 = MAX(y0, 0); y1 = MIN(y1, h);
+
+    // I rasterize the polygon into the scratch plane, and then copy it into the free pixels of the
+    // label map
+    CvPoint* contour = (CvPoint*)vertices;
+    cvZero(map->scratch);
+    cvFillPoly(map->scratch, &contour, &numVertices, 1, cvScalarAll(1), 8, 0);
+
+    for(int y = y0; y < y1; y++)
+    {
+        uint8_t*       labels = map->labels ->data.ptr + y * map->labels ->step;
+        const uint8_t* inside = map->scratch->data.ptr + y * map->scratch->step;
+
+        for(int x = x0; x < x1; x++)
+        {
+            if(inside[x] && labels[x] == 0)
+            {
+                labels[x] = label;
+                numPixels++;
+            }
+        }
+    }
+
+    map->numPixels[arena]   = numPixels;
+    map->arenaBounds[arena] = cvRect(x0, y0, MAX(x1 - x0, 0), MAX(y1 - y0, 0));
+    packArena(map, arena);
+    if(x1 > x0 && y1 > y0)
+        growBounds(map, x0, y0, x1, y1);
+    return arena;
+}
 
-void computeWormOccupancy(const CvMat* isolatedWorms,
-                          const CvPoint* leftCircle, const CvPoint* rightCircle,
-                          int circleRadius,
-                          double* left, double* right)
+void computeArenaOccupancy(const packedMask_t* isolatedWorms, const arenaMap_t* map,
+                           double occupancy[MAX_ARENAS])
 {
-    *left  = computeOccupancySingleCircle(isolatedWorms, leftCircle,  circleRadius);
-    *right = computeOccupancySingleCircle(isolatedWorms, rightCircle, circleRadius);
+    for(int i=0; i<map->numArenas; i++)
+    {
+        const packedMask_t* arena = &map->arenaMasks[i];
+        CvRect bounds = map->arenaBounds[i];
+        uint32_t numWorms = 0;
+
+        for(int y = 0; y < arena->height; y++)
+        {
+            const uint64_t* inside = &arena->words[y * arena->wordsPerRow];
+            const uint64_t* worms  = &isolatedWorms->words[(bounds.y + y) * isolatedWorms->wordsPerRow +
+                                                           bounds.x/64];
+            for(int k = 0; k < arena->wordsPerRow; k++)
+                numWorms += __builtin_popcountll(worms[k] & inside[k]);
+        }
+
+        occupancy[i] = map->numPixels[i] > 0 ? (double)numWorms / (double)map->numPixels[i] : 0.0;
+    }
 }
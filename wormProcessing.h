@@ -1,7 +1,29 @@
 #ifndef __WORM_PROCESSING_H__
 #define __WORM_PROCESSING_H__
 
+#include <stdint.h>
 #include "cvlib.hh"
+#include "packedMask.h"
+
+// How the presmoothing and detrending blurs are computed. VISION_SMOOTHING_GAUSSIAN is cvSmooth(),
+// whose cost grows with the kernel width. VISION_SMOOTHING_RECURSIVE is recursiveGaussian(), whose
+// cost doesn't, at the accuracy documented in recursiveGaussian.h
+typedef enum
+{
+    VISION_SMOOTHING_GAUSSIAN,
+    VISION_SMOOTHING_RECURSIVE
+} visionSmoothing_t;
+
+// The number format of the stages up to the division. VISION_PRECISION_FLOAT works on CV_32FC1
+// planes with OpenCV. VISION_PRECISION_FIXED16 works on 8.8 fixed-point CV_16UC1 planes
+// (fixedPoint.h), which halves the memory traffic and doubles the pixels per vector, and produces a
+// mask within a few hundredths of a percent of the float one. The fixed-point path always convolves:
+// smoothing only applies to the float one
+typedef enum
+{
+    VISION_PRECISION_FLOAT,
+    VISION_PRECISION_FIXED16
+} visionPrecision_t;
 
 typedef struct
 {
@@ -11,16 +33,120 @@ typedef struct
     unsigned int adaptive_threshold_kernel;
     unsigned int adaptive_threshold;
     unsigned int morphologic_depth;
+    visionSmoothing_t smoothing;
+    visionPrecision_t precision;
+
+    // The detrending background changes over minutes, so it can be cached. It's recomputed once
+    // every detrend_refresh_frames frames (every frame if this is 0 or 1), or sooner, if the
+    // brightness of any cell of a coarse grid over the frame moves by more than a fraction
+    // detrend_refresh_change of what it was when the background was computed, or if the parameters
+    // or regions it depends on change
+    unsigned int detrend_refresh_frames;
+    double       detrend_refresh_change;
 } visionParameters_t;
 
 void processingInit(int w, int h);
 void processingCleanup(void);
 void getDefaultParameters(visionParameters_t* params);
+
+// Adapts the parameters, tuned for full-resolution frames, to frames downsampled by the given factor
+// in each direction. The kernel widths and the morphology depth are in pixels, so they're divided by
+// the factor, keeping the widths odd. The detrending scale and the threshold are in intensity units,
+// and stay as they are. The kernel widths must already be odd
+void scaleParameters(visionParameters_t* params, int downsample);
 const CvMat* isolateWorms(const IplImage* input,
                           visionParameters_t* params);
-void computeWormOccupancy(const CvMat* isolatedWorms,
-                          const CvPoint* leftCircle, const CvPoint* rightCircle,
-                          int circleRadius,
-                          double* left, double* right);
+// The stages of isolateWorms(), for profiling. isolateWormsProfiled() reports how long each stage
+// took, in nanoseconds
+typedef enum
+{
+    VISION_STAGE_CONVERT,
+    VISION_STAGE_PRESMOOTH,
+    VISION_STAGE_DETREND,
+    VISION_STAGE_DIVIDE,
+    VISION_STAGE_THRESHOLD,
+    VISION_STAGE_MORPHOLOGY,
+    VISION_NUM_STAGES
+} visionStage_t;
+extern const char* const visionStageNames[VISION_NUM_STAGES];
+
+const CvMat* isolateWormsProfiled(const IplImage* input,
+                                  visionParameters_t* params,
+                                  uint64_t stageTimes_ns[VISION_NUM_STAGES]);
+
+// Like isolateWormsProfiled(), but only computes the mask inside the given regions. Each region is
+// grown by the support of the whole pipeline (getProcessingHalo()), so inside the regions the mask
+// is identical to the full-frame mask. With VISION_SMOOTHING_RECURSIVE the support is cut off at 4
+// sigma, so it's only nearly identical: pixels right at the threshold can flip. Outside the regions
+// the mask is left stale. Regions whose grown rectangles overlap are processed together. With
+// numRegions == 0, the whole frame is processed. At most MAX_ARENAS regions are accepted;
+// stageTimes_ns can be NULL
+const CvMat* isolateWormsSparse(const IplImage* input,
+                                visionParameters_t* params,
+                                const CvRect* regions, int numRegions,
+                                uint64_t stageTimes_ns[VISION_NUM_STAGES]);
+
+// Like isolateWormsSparse(), but the stages' outputs are kept, and reused while they're still valid.
+// frameId identifies the input frame: if it's the same as in the last call, only the stages whose
+// parameters (or whose upstream stages' parameters) changed are recomputed, so that retuning one
+// parameter on the same frame only reruns the stages from that one on. The regions must also lie
+// within those the kept outputs were computed over. With frameId == VISION_FRAME_UNKNOWN nothing is
+// reused. Each id must only ever be given to one frame; as a safeguard, the outputs are also only
+// reused if a coarse brightness grid of the input matches exactly
+#define VISION_FRAME_UNKNOWN UINT64_MAX
+const CvMat* isolateWormsMemoized(const IplImage* input, uint64_t frameId,
+                                  visionParameters_t* params,
+                                  const CvRect* regions, int numRegions,
+                                  uint64_t stageTimes_ns[VISION_NUM_STAGES]);
+int getProcessingHalo(const visionParameters_t* params);
+
+// The mask computed by the last isolateWorms*() call, packed a bit per pixel. The morphology works
+// on this, and the returned CV_8UC1 mask is unpacked from it
+const packedMask_t* getIsolatedWormsPacked(void);
+
+// The work planes and caches of one instance of the pipeline. The calls above all use a single
+// context, set up by processingInit(). More can be created to process several frames, or one frame
+// with several sets of parameters, at the same time: different contexts can be used from different
+// threads concurrently. isolateWormsInContext() is isolateWormsMemoized() in the given context, and
+// getContextWormsPacked() is its getIsolatedWormsPacked()
+typedef struct visionContext_t visionContext_t;
+visionContext_t* visionContextCreate(int w, int h);
+void             visionContextRelease(visionContext_t* ctx);
+const CvMat* isolateWormsInContext(visionContext_t* ctx,
+                                   const IplImage* input, uint64_t frameId,
+                                   visionParameters_t* params,
+                                   const CvRect* regions, int numRegions,
+                                   uint64_t stageTimes_ns[VISION_NUM_STAGES]);
+const packedMask_t* getContextWormsPacked(const visionContext_t* ctx);
+
+// The arenas whose occupancy is tracked. The label map stores, for each pixel, 1 + the index of the
+// arena that contains it, or 0 if it's outside every arena. Arenas shouldn't overlap; if they do,
+// the shared pixels belong to the arena that was added first. Each arena is also kept as a packed
+// mask over its bounds, with its first word aligned to the frame's words (starting at column
+// arenaBounds.x/64*64), so that computeArenaOccupancy() can count the worm pixels in each arena 64
+// at a time, by ANDing the words of the packed worm mask with the arena's, and counting the bits
+#define MAX_ARENAS 64
+
+typedef struct
+{
+    CvMat* labels;
+    CvMat* scratch;
+    CvRect bounds; // bounding box of all the arenas
+    int    numArenas;
+    int    numPixels[MAX_ARENAS];
+    CvRect arenaBounds[MAX_ARENAS];
+    packedMask_t arenaMasks[MAX_ARENAS];
+} arenaMap_t;
+
+void arenaMapInit   (arenaMap_t* map, int w, int h);
+void arenaMapRelease(arenaMap_t* map);
+void arenaMapClear  (arenaMap_t* map);
+
+// These return the index of the new arena, or -1 if there's no room for it
+int  arenaMapAddCircle (arenaMap_t* map, CvPoint center, int radius);
+int  arenaMapAddPolygon(arenaMap_t* map, const CvPoint* vertices, int numVertices);
+
+void computeArenaOccupancy(const packedMask_t* isolatedWorms, const arenaMap_t* map,
+                           double occupancy[MAX_ARENAS]);
 
 #endif
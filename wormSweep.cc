@@ -0,0 +1,493 @@
+// Occupancy over a grid of vision parameters, on one recording. Each frame is decoded once, and
+// handed to every configuration: the cartesian product of the values given for each swept
+// parameter, with the others at their defaults. The configurations are split among worker threads,
+// each with its own vision context (wormProcessing.h). Within a thread, the configurations are
+// processed in order of their parameters, stage by stage, so that consecutive ones share as many
+// upstream stages as possible, and the stage cache computes each shared intermediate plane once per
+// frame: all the configurations with the same presmoothing_w share one presmoothed plane, those
+// that also have the same detrend_w share one background, and so on. The configurations are split
+// among the threads along these groups, at the coarsest level that keeps every thread busy. Usage:
+//
+//   wormSweep [-a arenafile] [-n max_frames] [-j threads] [-o prefix] -p name=v0,v1,... [-p ...] source
+//
+// source and arenafile are as in wormOffline. name is one of the visionParameters_t fields
+// presmoothing_w, detrend_w, detrend_scale, adaptive_threshold_kernel, adaptive_threshold or
+// morphologic_depth; the kernel widths are made odd, as worm3 does. threads defaults to the number
+// of CPUs. The whole frame is processed, so a configuration's mask doesn't depend on the others.
+//
+// The time series of each configuration goes to prefixNNN.tsv (prefix defaults to "sweep_"), with
+// its parameters in the header, then a line per frame with the frame number, its timestamp and the
+// occupancy of each arena. A tab-separated index goes to stdout, one line per configuration with
+// its parameters, its mean occupancy over all the arenas and frames, and its file. A human-readable
+// summary goes to stderr
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <algorithm>
+#include <vector>
+using namespace std;
+
+#include "toolCommon.hh"
+
+#define DEFAULT_OUTPUT_PREFIX "sweep_"
+
+// frames are decoded in batches, into one buffer while the workers process the other
+#define BATCH_FRAMES 16
+
+// The swept parameters, in the order of the stages that use them. A configuration is identified by
+// its values of these, and configurations are sorted by them in this order
+enum
+{
+    PARAM_PRESMOOTHING_W,
+    PARAM_DETREND_W,
+    PARAM_DETREND_SCALE,
+    PARAM_ADAPTIVE_THRESHOLD_KERNEL,
+    PARAM_ADAPTIVE_THRESHOLD,
+    PARAM_MORPHOLOGIC_DEPTH,
+    NUM_SWEPT_PARAMS
+};
+
+static const char* const paramNames[NUM_SWEPT_PARAMS] =
+    { "presmoothing_w", "detrend_w", "detrend_scale",
+      "adaptive_threshold_kernel", "adaptive_threshold", "morphologic_depth" };
+
+// the first stage to use each parameter, counting from presmoothing: a configuration that differs
+// from the previous one first in parameter i reruns the stages from paramLevels[i] on
+static const int paramLevels[NUM_SWEPT_PARAMS] = { 0, 1, 2, 3, 3, 4 };
+#define NUM_LEVELS 5
+
+struct config_t
+{
+    double             values[NUM_SWEPT_PARAMS];
+    visionParameters_t params;
+    vector<double>     occupancy; // numArenas per frame, frame-major
+};
+
+struct batch_t
+{
+    IplImage* frames[BATCH_FRAMES];
+    uint64_t  firstFrame;
+    int       numFrames;
+};
+
+struct worker_t
+{
+    pthread_t        thread;
+    visionContext_t* ctx;
+    vector<int>      configs; // indices into the configs, in sorted order
+    double           time_ns;
+};
+
+static arena_t    arenas[MAX_ARENAS];
+static int        numArenas = 0;
+static arenaMap_t arenaMap;
+
+static vector<config_t> configs;
+static vector<worker_t> workers;
+
+// the workers and the decoding thread meet at this barrier at the start and at the end of each
+// batch. The batch being processed is batches[currentBatch]; a batch of no frames ends the workers
+static pthread_barrier_t batchBarrier;
+static batch_t           batches[2];
+static int               currentBatch;
+
+static void setParameter(visionParameters_t* params, int which, double value)
+{
+    switch(which)
+    {
+    case PARAM_PRESMOOTHING_W:            params->presmoothing_w            = (unsigned int)value | 1; break;
+    case PARAM_DETREND_W:                 params->detrend_w                 = (unsigned int)value | 1; break;
+    case PARAM_DETREND_SCALE:             params->detrend_scale             = value;                   break;
+    case PARAM_ADAPTIVE_THRESHOLD_KERNEL: params->adaptive_threshold_kernel = (unsigned int)value | 1; break;
+    case PARAM_ADAPTIVE_THRESHOLD:        params->adaptive_threshold        = (unsigned int)value;     break;
+    case PARAM_MORPHOLOGIC_DEPTH:         params->morphologic_depth         = (unsigned int)value;     break;
+    }
+}
+
+static double getParameter(const visionParameters_t* params, int which)
+{
+    switch(which)
+    {
+    case PARAM_PRESMOOTHING_W:            return params->presmoothing_w;
+    case PARAM_DETREND_W:                 return params->detrend_w;
+    case PARAM_DETREND_SCALE:             return params->detrend_scale;
+    case PARAM_ADAPTIVE_THRESHOLD_KERNEL: return params->adaptive_threshold_kernel;
+    case PARAM_ADAPTIVE_THRESHOLD:        return params->adaptive_threshold;
+    default:                              return params->morphologic_depth;
+    }
+}
+
+// parses name=v0,v1,... into the values of that parameter
+static bool parseSweep(char* arg, vector<double> values[NUM_SWEPT_PARAMS])
+{
+    char* equals = strchr(arg, '=');
+    if(equals == NULL)
+        return false;
+    *equals = '\0';
+
+    int which;
+    for(which=0; which<NUM_SWEPT_PARAMS; which++)
+        if(strcmp(arg, paramNames[which]) == 0)
+            break;
+    if(which == NUM_SWEPT_PARAMS)
+    {
+        fprintf(stderr, "unknown parameter '%s'\n", arg);
+        return false;
+    }
+
+    values[which].clear();
+    for(char* token = strtok(equals + 1, ","); token != NULL; token = strtok(NULL, ","))
+    {
+        char*  end;
+        double value = strtod(token, &end);
+        if(*end != '\0' || value < 0.0)
+        {
+            fprintf(stderr, "bad value '%s' for %s\n", token, paramNames[which]);
+            return false;
+        }
+        values[which].push_back(value);
+    }
+    return !values[which].empty();
+}
+
+// the cartesian product of the swept values. Unswept parameters keep their defaults
+static void buildConfigs(const vector<double> values[NUM_SWEPT_PARAMS])
+{
+    visionParameters_t defaults;
+    getDefaultParameters(&defaults);
+    makeKernelsOdd(&defaults);
+
+    int numConfigs = 1;
+    for(int i=0; i<NUM_SWEPT_PARAMS; i++)
+        if(!values[i].empty())
+            numConfigs *= values[i].size();
+
+    configs.resize(numConfigs);
+    for(int c=0; c<numConfigs; c++)
+    {
+        config_t* config = &configs[c];
+        config->params = defaults;
+
+        int index = c;
+        for(int i=NUM_SWEPT_PARAMS-1; i>=0; i--)
+            if(!values[i].empty())
+            {
+                setParameter(&config->params, i, values[i][index % values[i].size()]);
+                index /= values[i].size();
+            }
+
+        for(int i=0; i<NUM_SWEPT_PARAMS; i++)
+            config->values[i] = getParameter(&config->params, i);
+    }
+}
+
+// the first parameter in which two configurations differ, or NUM_SWEPT_PARAMS if they're the same
+static int firstDifference(const config_t& a, const config_t& b)
+{
+    int i;
+    for(i=0; i<NUM_SWEPT_PARAMS; i++)
+        if(a.values[i] != b.values[i])
+            break;
+    return i;
+}
+
+static bool configLess(const config_t& a, const config_t& b)
+{
+    int i = firstDifference(a, b);
+    return i < NUM_SWEPT_PARAMS && a.values[i] < b.values[i];
+}
+
+// The stages a worker runs per frame. The first configuration runs them all; each one after that
+// only runs those from the first stage whose parameters differ from the previous one's
+static int countStageRuns(const worker_t* worker)
+{
+    int runs = 0;
+    for(unsigned int i=0; i<worker->configs.size(); i++)
+    {
+        int level = 0;
+        if(i > 0)
+        {
+            int param = firstDifference(configs[worker->configs[i-1]], configs[worker->configs[i]]);
+            level = param == NUM_SWEPT_PARAMS ? NUM_LEVELS : paramLevels[param];
+        }
+        runs += NUM_LEVELS - level;
+    }
+    return runs;
+}
+
+// Splits the sorted configurations into groups that share their parameters up to some stage,
+// choosing the coarsest level that makes at least one group per worker, and hands the groups out,
+// largest first, to the least loaded worker. Each worker's configurations stay in sorted order
+static void assignConfigs(int numWorkers)
+{
+    vector< pair<int,int> > groups; // start, end
+    for(int level=0; level<=NUM_LEVELS; level++)
+    {
+        groups.clear();
+        int start = 0;
+        for(unsigned int c=1; c<=configs.size(); c++)
+        {
+            if(c < configs.size())
+            {
+                int param = firstDifference(configs[c-1], configs[c]);
+                if(param == NUM_SWEPT_PARAMS || paramLevels[param] > level)
+                    continue;
+            }
+            groups.push_back(make_pair(start, (int)c));
+            start = c;
+        }
+        if((int)groups.size() >= numWorkers)
+            break;
+    }
+
+    vector< pair<int,int> > bySize;
+    for(unsigned int g=0; g<groups.size(); g++)
+        bySize.push_back(make_pair(groups[g].second - groups[g].first, g));
+    sort(bySize.rbegin(), bySize.rend());
+
+    vector<int> load(numWorkers, 0);
+    for(unsigned int i=0; i<bySize.size(); i++)
+    {
+        int w = min_element(load.begin(), load.end()) - load.begin();
+        const pair<int,int>& group = groups[bySize[i].second];
+        for(int c=group.first; c<group.second; c++)
+            workers[w].configs.push_back(c);
+        load[w] += bySize[i].first;
+    }
+
+    for(int w=0; w<numWorkers; w++)
+        sort(workers[w].configs.begin(), workers[w].configs.end());
+}
+
+static void* workerThread(void* cookie)
+{
+    worker_t* worker = (worker_t*)cookie;
+    while(true)
+    {
+        pthread_barrier_wait(&batchBarrier);
+        const batch_t* batch = &batches[currentBatch];
+        if(batch->numFrames == 0)
+            break;
+
+        uint64_t t0 = getTime_ns();
+        for(int f=0; f<batch->numFrames; f++)
+            for(unsigned int i=0; i<worker->configs.size(); i++)
+            {
+                config_t* config = &configs[worker->configs[i]];
+                isolateWormsInContext(worker->ctx, batch->frames[f], batch->firstFrame + f,
+                                      &config->params, NULL, 0, NULL);
+
+                double occupancy[MAX_ARENAS];
+                computeArenaOccupancy(getContextWormsPacked(worker->ctx), &arenaMap, occupancy);
+                config->occupancy.insert(config->occupancy.end(), occupancy, occupancy + numArenas);
+            }
+        worker->time_ns += getTime_ns() - t0;
+
+        pthread_barrier_wait(&batchBarrier);
+    }
+    return NULL;
+}
+
+static int decodeBatch(FrameSource* source, batch_t* batch, uint64_t firstFrame, int maxFrames,
+                       vector<uint64_t>* timestamps)
+{
+    batch->firstFrame = firstFrame;
+    batch->numFrames  = 0;
+
+    uint64_t timestamp_us;
+    while(batch->numFrames < BATCH_FRAMES &&
+          (maxFrames == 0 || firstFrame + batch->numFrames < (uint64_t)maxFrames) &&
+          source->getNextFrame(&timestamp_us, batch->frames[batch->numFrames]))
+    {
+        timestamps->push_back(timestamp_us);
+        batch->numFrames++;
+    }
+    return batch->numFrames;
+}
+
+static bool writeTimeSeries(const char* filename, const config_t* config,
+                            const vector<uint64_t>& timestamps)
+{
+    FILE* fp = fopen(filename, "w");
+    if(fp == NULL)
+    {
+        fprintf(stderr, "couldn't open '%s' for writing\n", filename);
+        return false;
+    }
+
+    for(int i=0; i<NUM_SWEPT_PARAMS; i++)
+        fprintf(fp, "# %s %g\n", paramNames[i], config->values[i]);
+
+    fprintf(fp, "# frame\ttimestamp_us");
+    for(int a=0; a<numArenas; a++)
+        fprintf(fp, "\toccupancy_%d", a + 1);
+    fprintf(fp, "\n");
+
+    for(unsigned int f=0; f<timestamps.size(); f++)
+    {
+        fprintf(fp, "%u\t%llu", f, (unsigned long long)timestamps[f]);
+        for(int a=0; a<numArenas; a++)
+            fprintf(fp, "\t%.6f", config->occupancy[f*numArenas + a]);
+        fprintf(fp, "\n");
+    }
+
+    fclose(fp);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    const char*    arenaFile  = NULL;
+    const char*    prefix     = DEFAULT_OUTPUT_PREFIX;
+    int            maxFrames  = 0;
+    int            numWorkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    vector<double> values[NUM_SWEPT_PARAMS];
+    bool           haveSweep  = false;
+
+    int opt;
+    while((opt = getopt(argc, argv, "a:n:j:o:p:")) != -1)
+    {
+        if     (opt == 'a') arenaFile  = optarg;
+        else if(opt == 'n') maxFrames  = atoi(optarg);
+        else if(opt == 'j') numWorkers = atoi(optarg);
+        else if(opt == 'o') prefix     = optarg;
+        else if(opt == 'p')
+        {
+            if(!parseSweep(optarg, values))
+            {
+                fprintf(stderr, "-p takes name=v0,v1,...\n");
+                return 1;
+            }
+            haveSweep = true;
+        }
+        else
+            break;
+    }
+    if(opt != -1 || optind != argc-1 || !haveSweep)
+    {
+        fprintf(stderr, "usage: %s [-a arenafile] [-n max_frames] [-j threads] [-o prefix] -p name=v0,v1,... [-p ...] source\n",
+                argv[0]);
+        return 1;
+    }
+    const char* sourceName = argv[optind];
+
+    if(maxFrames <= 0)
+        maxFrames = getDefaultMaxFrames(sourceName);
+
+    FrameSource* source = openSource(sourceName);
+    if(source == NULL || ! *source)
+    {
+        fprintf(stderr, "couldn't open frame source '%s'\n", sourceName);
+        delete source;
+        return 1;
+    }
+    int w = source->w(), h = source->h();
+
+    if(arenaFile != NULL)
+    {
+        if(!readArenaFile(arenaFile, arenas, &numArenas))
+            return 1;
+    }
+    else
+    {
+        setDefaultArenas(arenas, &numArenas, w, h);
+    }
+    arenaMapInit(&arenaMap, w, h);
+    arenaMapAddArenas(&arenaMap, arenas, numArenas, 1);
+
+    buildConfigs(values);
+    sort(configs.begin(), configs.end(), configLess);
+    numWorkers = max(1, min(numWorkers, (int)configs.size()));
+
+    workers.resize(numWorkers);
+    assignConfigs(numWorkers);
+
+    int stageRuns = 0;
+    for(int i=0; i<numWorkers; i++)
+    {
+        workers[i].ctx     = visionContextCreate(w, h);
+        workers[i].time_ns = 0.0;
+        stageRuns += countStageRuns(&workers[i]);
+    }
+    fprintf(stderr, "%d configurations on %d threads: %d stage runs per frame, against %d without sharing\n",
+            (int)configs.size(), numWorkers, stageRuns, (int)configs.size() * NUM_LEVELS);
+
+    for(int b=0; b<2; b++)
+        for(int f=0; f<BATCH_FRAMES; f++)
+            batches[b].frames[f] = cvCreateImage(cvSize(w, h), IPL_DEPTH_8U, 1);
+
+    pthread_barrier_init(&batchBarrier, NULL, numWorkers + 1);
+    for(int i=0; i<numWorkers; i++)
+        pthread_create(&workers[i].thread, NULL, &workerThread, &workers[i]);
+
+    // the next batch is decoded while the workers process the current one
+    uint64_t         t0 = getTime_ns();
+    vector<uint64_t> timestamps;
+    uint64_t         numFrames = 0;
+    currentBatch = 0;
+    numFrames += decodeBatch(source, &batches[0], 0, maxFrames, &timestamps);
+    while(true)
+    {
+        int numInBatch = batches[currentBatch].numFrames;
+        pthread_barrier_wait(&batchBarrier);
+        if(numInBatch == 0)
+            break;
+
+        numFrames += decodeBatch(source, &batches[1 - currentBatch], numFrames, maxFrames, &timestamps);
+        pthread_barrier_wait(&batchBarrier);
+        currentBatch = 1 - currentBatch;
+    }
+    double elapsed_ns = getTime_ns() - t0;
+
+    for(int i=0; i<numWorkers; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        visionContextRelease(workers[i].ctx);
+    }
+    pthread_barrier_destroy(&batchBarrier);
+    for(int b=0; b<2; b++)
+        for(int f=0; f<BATCH_FRAMES; f++)
+            cvReleaseImage(&batches[b].frames[f]);
+    arenaMapRelease(&arenaMap);
+    delete source;
+
+    if(numFrames == 0)
+    {
+        fprintf(stderr, "couldn't read any frames from '%s'\n", sourceName);
+        return 1;
+    }
+
+    printf("# config");
+    for(int i=0; i<NUM_SWEPT_PARAMS; i++)
+        printf("\t%s", paramNames[i]);
+    printf("\tmean_occupancy\tfile\n");
+
+    bool ok = true;
+    for(unsigned int c=0; c<configs.size(); c++)
+    {
+        char filename[1024];
+        snprintf(filename, sizeof(filename), "%s%03u.tsv", prefix, c);
+        ok = writeTimeSeries(filename, &configs[c], timestamps) && ok;
+
+        double sum = 0.0;
+        for(unsigned int i=0; i<configs[c].occupancy.size(); i++)
+            sum += configs[c].occupancy[i];
+
+        printf("%u", c);
+        for(int i=0; i<NUM_SWEPT_PARAMS; i++)
+            printf("\t%g", configs[c].values[i]);
+        printf("\t%.6f\t%s\n", sum / configs[c].occupancy.size(), filename);
+    }
+
+    double busiest_ns = 0.0;
+    for(int i=0; i<numWorkers; i++)
+        busiest_ns = max(busiest_ns, workers[i].time_ns);
+    fprintf(stderr, "%llu frames in %.2f s: %.3f ms/frame for all the configurations, %.3f ms/frame in the busiest thread\n",
+            (unsigned long long)numFrames, elapsed_ns / 1e9, elapsed_ns / numFrames / 1e6,
+            busiest_ns / numFrames / 1e6);
+
+    return ok ? 0 : 1;
+}